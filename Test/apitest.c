@@ -0,0 +1,430 @@
+//
+// tests of the parts of the C interface which scripts cannot reach;
+// runtests.sh compares the output with apitest.expect
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../tinyscript.h"
+#include "../tinyscript_lib.h"
+
+// output is dropped while this is set
+static int quiet;
+
+void outchar(int c) {
+    if (!quiet) putchar(c);
+}
+
+// the number of blocks from ts_malloc not yet freed
+static long live;
+// larger requests fail, if this is set
+static Val maxalloc;
+
+void * ts_malloc(Val size) {
+    void *p = (maxalloc && size > maxalloc) ? NULL : malloc(size);
+    if (p) live++;
+    return p;
+}
+
+void ts_free(void * pointer) {
+    if (pointer) live--;
+    free(pointer);
+}
+
+static Val arena[1024];
+
+// a builtin which calls back into the script
+static Val callback(Val x)
+{
+    Val r;
+    int err = TinyScript_Call(TinyScript_Lookup("twice"), &x, 1, &r);
+    return err ? err : r;
+}
+
+// the function is defined after (at a higher address than) the script
+// which calls it, so that an error in the script is shown correctly
+// only if the call leaves the error position alone
+static const char callscripts[] =
+    "var y = callback(4)\nprint \"y = \", y\ny = y + + \0"
+    "func twice(x) {\nreturn 2*x\n}\n";
+
+static void
+test_call(void)
+{
+    Val args[2] = { 3, 4 };
+    Val r = 0;
+    Sym *fn;
+    int err;
+
+    printf("# TinyScript_Lookup and TinyScript_Call\n");
+    TinyScript_Init(arena, sizeof(arena));
+    TinyScript_Define("callback", CFUNC(1), (Val)callback);
+    TinyScript_Run("var n = 5\nfunc add(a, b) {\nreturn a+b+n\n}\n", 0, 1);
+    fn = TinyScript_Lookup("add");
+    err = TinyScript_Call(fn, args, 2, &r);
+    printf("add(3, 4) = %ld, error %d\n", (long)r, err);
+    err = TinyScript_Call(fn, args, 1, &r);
+    printf("add(3): error %d\n", err);
+    err = TinyScript_Call(TinyScript_Lookup("n"), args, 0, &r);
+    printf("n(): error %d\n", err);
+    err = TinyScript_Call(TinyScript_Lookup("nosuch"), args, 0, &r);
+    printf("nosuch(): error %d\n", err);
+    err = TinyScript_Call(TinyScript_Lookup("callback"), args, 1, &r);
+    printf("callback(3) before twice is defined = %ld, error %d\n", (long)r, err);
+    TinyScript_Run(callscripts + sizeof("var y = callback(4)\nprint \"y = \", y\ny = y + + "), 0, 1);
+    err = TinyScript_Run(callscripts, 0, 1);
+    printf("error %d\n", err);
+}
+
+#ifdef EXPR_COMPILE
+#define LONGNAME "_abcdefghijklmnopqrstuvwxyz_abcdefghijklmnopqrstuvwxyz_abcdef"
+
+// the number of times text compiles before memory runs out
+static int
+compileall(const char *text)
+{
+    int n = 0;
+
+    while (TinyScript_CompileExpr(text)) {
+        n++;
+    }
+    return n;
+}
+
+static void
+test_expr(void)
+{
+    char text[128];
+    CompiledExpr *e;
+    Val bindings[2];
+    Val r = 0;
+    int err;
+    int i, n, m;
+    int size, lost;
+
+    printf("# TinyScript_CompileExpr and TinyScript_EvalExpr\n");
+    TinyScript_Init(arena, sizeof(arena));
+    TinyScript_Run("func sq(x) {\nreturn x*x\n}\n", 0, 1);
+    e = TinyScript_CompileExpr("b * 10 + sq(a) - a");
+    printf("slots: a %d, b %d, c %d\n", TinyScript_ExprSlot(e, "a"),
+           TinyScript_ExprSlot(e, "b"), TinyScript_ExprSlot(e, "c"));
+    for (i = 0; i < 3; i++) {
+        bindings[TinyScript_ExprSlot(e, "a")] = i + 2;
+        bindings[TinyScript_ExprSlot(e, "b")] = 5 - i;
+        err = TinyScript_EvalExpr(e, bindings, &r);
+        printf("a=%d b=%d: %ld, error %d\n", i + 2, 5 - i, (long)r, err);
+    }
+    // errors give NULL, after a message
+    e = TinyScript_CompileExpr("a +");
+    printf("incomplete: %s\n", e ? "compiled" : "NULL");
+    e = TinyScript_CompileExpr("a b");
+    printf("two names: %s\n", e ? "compiled" : "NULL");
+    strcpy(text, "v0");
+    for (i = 1; i <= 16; i++) {
+        sprintf(text + strlen(text), "+v%d", i);
+    }
+    e = TinyScript_CompileExpr(text);
+    printf("17 variables: %s\n", e ? "compiled" : "NULL");
+    text[0] = 0;
+    for (i = 0; i < 16; i++) {
+        strcat(text, "1+(");
+    }
+    strcat(text, "1");
+    for (i = 0; i < 16; i++) {
+        strcat(text, ")");
+    }
+    e = TinyScript_CompileExpr(text);
+    printf("17 deep: %s\n", e ? "compiled" : "NULL");
+    text[strlen(text) - 1] = 0;
+    memmove(text, text + 3, strlen(text + 3) + 1);
+    e = TinyScript_CompileExpr(text);
+    err = e ? TinyScript_EvalExpr(e, bindings, &r) : -1;
+    printf("16 deep: %ld, error %d\n", (long)r, err);
+
+    // running out of room for the variable names gives everything back;
+    // the arena sizes cover every amount of room left at the end
+    sprintf(text, "v0%.58s + v1%.58s", LONGNAME, LONGNAME);
+    quiet = 1;
+    for (size = sizeof(arena) - 512, lost = 0; size <= (int)sizeof(arena); size += sizeof(Val)) {
+        TinyScript_Init(arena, size);
+        n = compileall(text);
+        m = compileall("1 + 2");
+        TinyScript_Init(arena, size);
+        for (i = 0; i < n; i++) {
+            TinyScript_CompileExpr(text);
+        }
+        if (m != compileall("1 + 2")) {
+            lost++;
+        }
+    }
+    quiet = 0;
+    printf("out of memory for names: space lost %d times\n", lost);
+}
+
+// evaluate e over nrows rows both ways, and count the rows which differ
+#define BATCH_ROWS 77  // not a multiple of the block size
+
+static int
+batchdiffs(CompiledExpr *e, const Val * const *columns, int nslots, int nrows)
+{
+    Val out[BATCH_ROWS];
+    Val bindings[MAX_BUILTIN_PARAMS];
+    Val r;
+    int diffs = 0;
+    int i, j;
+
+    if (TinyScript_EvalExprBatch(e, columns, nrows, out) != TS_ERR_OK) {
+        return -1;
+    }
+    for (i = 0; i < nrows; i++) {
+        for (j = 0; j < nslots; j++) {
+            bindings[j] = columns[j][i];
+        }
+        if (TinyScript_EvalExpr(e, bindings, &r) != TS_ERR_OK || r != out[i]) {
+            diffs++;
+        }
+    }
+    return diffs;
+}
+
+// the value of e (with slots a and b) for one row
+static Val
+batchrow(CompiledExpr *e, Val a, Val b)
+{
+    Val bindings[2];
+    Val r = 0;
+
+    bindings[TinyScript_ExprSlot(e, "a")] = a;
+    bindings[TinyScript_ExprSlot(e, "b")] = b;
+    TinyScript_EvalExpr(e, bindings, &r);
+    return r;
+}
+
+static void
+test_batch(void)
+{
+    static Val a[BATCH_ROWS], b[BATCH_ROWS];
+    const Val *columns[2] = { a, b };
+    Val x[1 + BATCH_ROWS], y[1 + BATCH_ROWS], z[1 + BATCH_ROWS];
+    Val *arrays[2] = { x, y };
+    CompiledExpr *e, *k;
+    int i;
+
+    printf("# TinyScript_EvalExprBatch and TinyScript_EvalExprArrays\n");
+    TinyScript_Init(arena, sizeof(arena));
+    TinyScript_Run("func sq(x) {\nreturn x*x\n}\n", 0, 1);
+    for (i = 0; i < BATCH_ROWS; i++) {
+        a[i] = i * 7 - 200;
+        b[i] = (i * 13) % 50 + 1;
+    }
+    e = TinyScript_CompileExpr("a * 3 - a / b + (a > b) + sq(b) % 7 - (b << 2 >> 1)");
+    k = TinyScript_CompileExpr("2 + 3 * 4");
+    printf("%d rows: %d differ\n", BATCH_ROWS, batchdiffs(e, columns, 2, BATCH_ROWS));
+    printf("1 row: %d differ\n", batchdiffs(e, columns, 2, 1));
+    printf("constant, %d rows: %d differ\n", BATCH_ROWS, batchdiffs(k, columns, 0, BATCH_ROWS));
+    // a function which makes an array assignment runs a batch of its own
+    TinyScript_Run("func rowsum(x) {\narray t(3) = 1, 2, 3\nt = t * x + 1\n"
+                   "return t(0) + t(1) + t(2)\n}\n", 0, 1);
+    e = TinyScript_CompileExpr("a * 1000 + rowsum(b)");
+    printf("nested, %d rows: %d differ, ", BATCH_ROWS, batchdiffs(e, columns, 2, BATCH_ROWS));
+    printf("row 5 = %ld\n", (long)batchrow(e, a[5], b[5]));
+    e = TinyScript_CompileExpr("a * 3 - a / b + (a > b) + sq(b) % 7 - (b << 2 >> 1)");
+
+    x[0] = y[0] = BATCH_ROWS;
+    for (i = 0; i < BATCH_ROWS; i++) {
+        x[i + 1] = a[i];
+        y[i + 1] = b[i];
+    }
+    z[0] = BATCH_ROWS - 10;
+    z[BATCH_ROWS - 10 + 1] = -1;
+    printf("arrays: error %d, ", TinyScript_EvalExprArrays(e, arrays, z));
+    for (i = 0; i < z[0] && z[i + 1] == batchrow(e, a[i], b[i]); i++)
+        ;
+    printf("%d rows right, next left as %ld\n", i, (long)z[z[0] + 1]);
+    y[0] = z[0] - 1;
+    printf("short column: error %d\n", TinyScript_EvalExprArrays(e, arrays, z));
+}
+#endif
+
+#ifdef TS_LIB_POOL
+static void
+showpools(const char *when)
+{
+    ts_pool_stats stats[TS_POOL_CLASSES];
+    int n = ts_pool_get_stats(stats, TS_POOL_CLASSES);
+    int i;
+
+    printf("%s:", when);
+    for (i = 0; i < n; i++) {
+        if (stats[i].slabs) {
+            printf(" %ld: %ld slabs %ld in use %ld free", (long)stats[i].block_size,
+                   (long)stats[i].slabs, (long)stats[i].in_use, (long)stats[i].free);
+        }
+    }
+    printf("\n");
+}
+
+// freed blocks go back to their pool and are used again
+static void
+test_pool(void)
+{
+    ts_list *lists[100];
+    int i;
+
+    printf("# ts_pool_get_stats\n");
+    showpools("at first");
+    for (i = 0; i < 100; i++) {
+        lists[i] = ts_list_new(40);
+    }
+    showpools("100 lists");
+    for (i = 0; i < 100; i++) {
+        ts_list_free(lists[i]);
+    }
+    showpools("freed");
+    for (i = 0; i < 100; i++) {
+        lists[i] = ts_list_new(40);
+    }
+    showpools("100 again");
+    for (i = 0; i < 100; i++) {
+        ts_list_free(lists[i]);
+    }
+
+    // a list whose elements cannot be allocated gives its header back
+    maxalloc = 1000;
+    printf("list too big: %s, ", ts_list_new(5000) ? "made" : "NULL");
+    maxalloc = 0;
+    showpools("after");
+
+    // the free builtin gives blocks back to their pool too (the two
+    // interned string literals stay)
+    TinyScript_Init(arena, sizeof(arena));
+    ts_define_funcs();
+    TinyScript_Run("var l = list_new(40)\nfree(l)\nfree(map_new(4))\nfree(str_cat(\"x\", \"y\"))\n", 0, 1);
+    showpools("freed by a script");
+}
+#endif
+
+#ifdef TS_LIB_REGION
+// everything made in a region goes when it ends
+static void
+test_region(void)
+{
+    long before = live;
+    ts_region_state none, first;
+    ts_list *kept;
+    ts_list *list;
+    ts_map *map;
+    ts_map *keptmap;
+    ts_str *keptstr;
+    int i;
+
+    printf("# ts_region_begin and ts_region_end\n");
+    printf("begin: %d, ", ts_region_begin());
+    printf("again: %d\n", ts_region_begin());
+    for (i = 0; i < 200; i++) {
+        list = ts_list_new(8);
+        ts_list_push(list, i);
+    }
+    map = ts_map_new(4);
+    for (i = 0; i < 100; i++) {
+        ts_map_set(map, i, i * i);
+    }
+    list = ts_list_new(10000);
+    ts_list_push_(list, 1, 2);
+    kept = ts_list_promote(list);
+    keptmap = ts_map_promote(map);
+    keptstr = ts_str_promote(ts_str_cat(ts_str_new("made in ", 8), ts_str_new("a region", 8)));
+    printf("used: %s, map(9) = %ld\n", ts_region_used() > 10000 ? "> 10000" : "too little",
+           (long)ts_map_get(map, 9));
+    ts_region_end();
+    printf("after end: used %ld, blocks left %ld\n", (long)ts_region_used(), live - before);
+    printf("promoted: %ld elements, %ld %ld\n", (long)ts_list_size(kept),
+           (long)ts_list_get(kept, 0), (long)ts_list_get(kept, 1));
+    printf("promoted map: %ld keys, map(9) = %ld, map(99) = %ld\n", (long)ts_map_size(keptmap),
+           (long)ts_map_get(keptmap, 9), (long)ts_map_get(keptmap, 99));
+    printf("promoted string: %s\n", keptstr->bytes);
+    printf("promoting again: %d %d %d\n", ts_list_promote(kept) == kept,
+           ts_map_promote(keptmap) == keptmap, ts_str_promote(keptstr) == keptstr);
+    ts_list_free(kept);
+    ts_map_free(keptmap);
+    ts_str_free(keptstr);
+    printf("begin after end: %d\n", ts_region_begin());
+    ts_region_end();
+
+    // two regions kept side by side
+    ts_region_save(&none);
+    ts_region_begin();
+    kept = ts_list_new(4);
+    ts_list_push(kept, 7);
+    ts_region_save(&first);
+    ts_region_switch(&none);
+    printf("begin while the first is put aside: %d\n", ts_region_begin());
+    for (i = 0; i < 100; i++) {
+        list = ts_list_new(4);
+        ts_list_push_(list, 55, 66);
+    }
+    ts_region_end();
+    ts_region_switch(&first);
+    printf("first region's list: %ld elements, %ld\n", (long)ts_list_size(kept),
+           (long)ts_list_get(kept, 0));
+    ts_region_end();
+    // one chunk is kept for the next region
+    printf("blocks left %ld\n", live - before);
+}
+#endif
+
+// formats longer than 64K are printed in full
+static Val outlen;
+static char outtail[16];
+
+static void
+countoutput(const char *buf, Val len)
+{
+    Val i;
+
+    for (i = 0; i < len; i++) {
+        memmove(outtail, outtail + 1, sizeof(outtail) - 2);
+        outtail[sizeof(outtail) - 2] = buf[i];
+    }
+    outlen += len;
+}
+
+static void
+test_format(void)
+{
+    Val n = 70000;
+    char *text = malloc(n);
+    ts_str *fmt;
+    Val r;
+
+    printf("# ts_format\n");
+    memset(text, '.', n);
+    memcpy(text, "%d", 2);
+    memcpy(text + n - 6, "%s|%d", 5);
+    text[n - 1] = '!';
+    fmt = ts_str_new(text, n);
+    ts_set_output(countoutput);
+    r = ts_printf__(fmt, 1, (Val)ts_str_new("end", 3), 2);
+    ts_set_output(NULL);
+    printf("%ld bytes written, %ld counted, ending %s\n", (long)r, (long)outlen, outtail + 5);
+    ts_str_free(fmt);
+    free(text);
+}
+
+int
+main()
+{
+    test_call();
+    test_format();
+#ifdef EXPR_COMPILE
+    test_expr();
+    test_batch();
+#endif
+#ifdef TS_LIB_POOL
+    test_pool();
+#endif
+#ifdef TS_LIB_REGION
+    test_region();
+#endif
+    return 0;
+}
@@ -0,0 +1,67 @@
+# whole array arithmetic
+array a(4) = 1, 2, 3, 4
+array b(4) = 10, 20, 30, 40
+array c(4)
+
+func show(x) {
+	array x
+	print x(0), " ", x(1), " ", x(2), " ", x(3)
+}
+
+c = a + b
+show(c)
+c = a * 3
+show(c)
+var k = 5
+c = k - a * 2 + b(0)
+show(c)
+c = (a + 1) * (b - a) >> 1
+show(c)
+c = a > 2
+show(c)
+c = -a
+show(c)
+
+# the destination may also be a source
+a = a + a
+show(a)
+
+# a list of values still sets the first elements
+c = 7, 8
+show(c)
+
+# arrays may be initialized with an expression
+array d(3) = b * b
+print d(0), " ", d(1), " ", d(2)
+
+# script functions are called once, and may use arrays of their own
+func f(x) {
+  return x
+}
+b = a + f(100)
+show(b)
+func g(x) {
+  array t(4)
+  t = a * x
+  return t(3)
+}
+b = g(2) + a * 10 + g(3)
+show(b)
+b = a + a(f(2))
+show(b)
+
+# an array passed to a function is not an array expression,
+# so only the first element is set
+func last(x) {
+  array x
+  return x(3)
+}
+array h(4) = 1, 2, 3, 4
+h = last(a)
+show(h)
+h = a(last(h) / 4) + a * 0
+show(h)
+
+# a longer destination is out of bounds
+array e(5)
+e = a + b
@@ -0,0 +1,46 @@
+# standard library array functions
+array a(6) = 5, -2, 9, 4, 9, 1
+array b(6) = 1, 2, 3, 4, 5, 6
+array c(3)
+
+print "sum=", array_sum(a), " min=", array_min(a), " max=", array_max(a)
+print "dot=", array_dot(a, b)
+print "count 9=", array_count(a, 9), " find 9=", array_find(a, 9), " find 7=", array_find(a, 7)
+
+print "copied ", array_copy(c, b, 2, 3)
+print c(0), " ", c(1), " ", c(2)
+print "too many ", array_copy(c, b, 4, 3)
+
+array_fill(b, 7)
+print "filled sum=", array_sum(b)
+
+# anything which is not an array is rejected
+print "not an array: ", array_sum(12345)
+
+# sorting and searching
+array t(8) = 30, 10, 50, 20, 40, 20, -5, 0
+array_sort(t)
+print t(0), " ", t(1), " ", t(2), " ", t(3), " ", t(4), " ", t(5), " ", t(6), " ", t(7)
+print "lower 20=", array_lower_bound(t, 20), " upper 20=", array_upper_bound(t, 20)
+print "lower 25=", array_lower_bound(t, 25), " upper 99=", array_upper_bound(t, 99)
+
+# a long array is radix sorted
+array r(300)
+var seed = 1
+var i = 0
+while i < r(-1) {
+	seed = (seed * 1103515245 + 12345) & 0x7fffffff
+	r(i) = (seed >> 8) % 2000 - 1000
+	i = i + 1
+}
+var total = array_sum(r)
+array_sort(r)
+var ok = array_sum(r) = total
+i = 1
+while i < r(-1) {
+	if r(i - 1) > r(i) {
+		ok = 0
+	}
+	i = i + 1
+}
+print "long sort ok=", ok
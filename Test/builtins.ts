@@ -0,0 +1,23 @@
+# builtins come from a table shared by all contexts
+
+print "dsqr(3, 4) is ", dsqr(3, 4)
+var n = list_new(2)
+list_push(n, 7)
+print "list_size(n) is ", list_size(n)
+list_free(n)
+
+# free takes a list, a map or a string
+var l = list_new(4)
+list_push(l, 1)
+free(l)
+free(map_new(8))
+free(str_cat("a", "b"))
+free(0)
+print "freed"
+
+print "a local name may hide a builtin"
+func f(dsqr) {
+  return dsqr * 2
+}
+print "f(5) is ", f(5)
+print "dsqr(1, 1) is still ", dsqr(1, 1)
@@ -0,0 +1,12 @@
+# state which is checkpointed and carried on by checkpoint.tsr
+var runs = 0
+var total = 0
+array history(4)
+func record(x) {
+  history(runs % 4) = x
+  runs = runs + 1
+  total = total + x
+  return total
+}
+record(5)
+print "checkpoint defined ", runs, " ", total
@@ -0,0 +1,133 @@
+//
+// tests of the C++ interface in tinyscript.hpp; runtests.sh compares
+// the output with hpptest.expect
+//
+#include <cstdio>
+#include <cstdlib>
+#include "../tinyscript.hpp"
+
+extern "C" {
+
+void outchar(int c) {
+    std::putchar(c);
+}
+
+void * ts_malloc(Val size) {
+    return std::malloc(size);
+}
+
+void ts_free(void * pointer) {
+    std::free(pointer);
+}
+
+}
+
+enum class color { red, green, blue };
+
+static int total;
+
+static long add3(short a, int b, long c) { return a + b + c; }
+static bool is_blue(color c) { return c == color::blue; }
+static void tally(unsigned n) { total += n; }
+static const char *hello() { return "hello"; }
+static int first(const char *s) { return s[0]; }
+
+// doubles every element, and returns the sum of the old ones
+static Val twice(ts::array_ref a)
+{
+    Val sum = 0;
+    for (Val &x : a) {
+        sum += x;
+        x *= 2;
+    }
+    return sum;
+}
+
+#ifdef ARRAY_SUPPORT
+static int check(ts::array_ref a) { return a.valid(); }
+#endif
+
+static Val count(int argc, Val *argv)
+{
+    (void)argv;
+    return argc;
+}
+
+static ts::Context<8192> ctx;
+static ts::Context<8192> copy;
+static ts::Context<4096> other;
+
+// a builtin which runs a function in another context
+static Val other_square(Val x)
+{
+    Val r = 0;
+    int err = other.call(other.lookup("square"), &r, x);
+    return err ? err : r;
+}
+
+int
+main()
+{
+    Val r = 0;
+    int err;
+
+    std::printf("# builtins\n");
+    std::printf("init: %d\n", ctx.error());
+    ctx.define<add3>("add3");
+    ctx.define<is_blue>("is_blue");
+    ctx.define<tally>("tally");
+    ctx.define<hello>("hello");
+    ctx.define<first>("first");
+    ctx.define<twice>("twice");
+#ifdef ARRAY_SUPPORT
+    ctx.define<check>("check");
+#endif
+    ctx.define_variadic<count>("count", 1);
+    err = ctx.run("print add3(1, 2, 3), \" \", is_blue(2), \" \", is_blue(1)\n"
+                  "tally(5)\ntally(7)\n"
+                  "print first(hello()), \" \", count(1, 2, 3)\n", false, true);
+    std::printf("run: %d, total %d\n", err, total);
+#ifdef ARRAY_SUPPORT
+    err = ctx.run("array a(3) = 1, 2, 3\n"
+                  "print twice(a), \" \", a(0), \" \", a(1), \" \", a(2)\n"
+                  "print check(a), \" \", check(0)\n", false, true);
+    std::printf("arrays: %d\n", err);
+#endif
+
+    std::printf("# calls\n");
+    ctx.run("var base = 100\nfunc addbase(x, y) {\nreturn base + x + y\n}\n", false, true);
+    err = ctx.call(ctx.lookup("addbase"), &r, 1, 2);
+    std::printf("addbase(1, 2) = %ld, error %d\n", (long)r, err);
+    err = ctx.call(ctx.lookup("add3"), &r, 10, 20, 30L);
+    std::printf("add3(10, 20, 30) = %ld, error %d\n", (long)r, err);
+    err = ctx.call(ctx.lookup("addbase"), &r, 1);
+    std::printf("addbase(1): error %d\n", err);
+
+    std::printf("# separate contexts\n");
+    other.run("var x = 42\nfunc square(v) {\nreturn v*v\n}\n", false, true);
+    err = ctx.run("print x\n", false, true);
+    std::printf("x in ctx: error %d\n", err);
+    ctx.define<other_square>("other_square");
+    err = ctx.run("var x = 7\nprint other_square(x), \" \", x\n", false, true);
+    std::printf("other_square: error %d\n", err);
+    err = other.run("print x\n", false, true);
+    std::printf("x in other: error %d\n", err);
+    std::printf("square in ctx: %s\n", ctx.lookup("square") ? "found" : "not found");
+
+    std::printf("# snapshot and clone\n");
+    int size = ctx.snapshot(nullptr, 0);
+    void *snap = std::malloc(size);
+    std::printf("snapshot: %s\n", ctx.snapshot(snap, size) == size ? "ok" : "failed");
+    ctx.run("base = 1000\n", false, true);
+    err = copy.clone(snap);
+    std::printf("clone: %d\n", err);
+    err = copy.call(copy.lookup("addbase"), &r, 1, 2);
+    std::printf("addbase(1, 2) in the copy = %ld, error %d\n", (long)r, err);
+    copy.run("base = 10\n", false, true);
+    err = ctx.call(ctx.lookup("addbase"), &r, 1, 2);
+    std::printf("addbase(1, 2) in the original = %ld, error %d\n", (long)r, err);
+    err = copy.call(copy.lookup("addbase"), &r, 1, 2);
+    std::printf("addbase(1, 2) in the copy = %ld, error %d\n", (long)r, err);
+    std::free(snap);
+    return 0;
+}
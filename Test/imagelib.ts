@@ -0,0 +1,17 @@
+# definitions which are saved in an image and used by imagelib.tsu
+var scale = 3
+array table(4) = 2, 3, 5, 7
+array8 bytes(3) = 'a', 'b', 'c'
+func scaled(x) {
+  return x * scale
+}
+func tablesum() {
+  var i = 0
+  var s = 0
+  while i < table(-1) {
+    s = s + table(i)
+    i = i + 1
+  }
+  return s
+}
+print "imagelib defined ", tablesum()
@@ -0,0 +1,77 @@
+# hash maps keyed by values
+var m = map_new(0)
+map_set(m, 10, 100)
+map_set(m, -3, 30)
+map_set(m, 10, 101)
+print "size=", map_size(m)
+print map_get(m, 10), " ", map_get(m, -3), " missing=", map_get(m, 7)
+print "has 7=", map_has(m, 7), " has -3=", map_has(m, -3)
+
+# missing keys which land in slots next to used ones
+var i = 5000
+var k = 0
+while i < 5064 {
+  k = k + map_has(m, i) + map_del(m, i)
+  i = i + 1
+}
+print "missing found=", k, " has 10=", map_has(m, 10)
+
+# counting, with growth
+i = 0
+k = 0
+while i < 1000 {
+  k = i % 37
+  if map_has(m, k) {
+    map_set(m, k, map_get(m, k) + 1)
+  } else {
+    map_set(m, k, 1)
+  }
+  i = i + 1
+}
+print "size=", map_size(m)
+print map_get(m, 0), " ", map_get(m, 36), " ", map_get(m, 10)
+
+# deleting keeps the other keys reachable
+i = 0
+while i < 37 {
+  if i % 2 {
+    map_del(m, i)
+  }
+  i = i + 1
+}
+print "del 1=", map_del(m, 1), " del 2=", map_del(m, 2)
+print "size=", map_size(m)
+var sum = 0
+var n = 0
+i = map_iter(m, 0)
+while i >= 0 {
+  sum = sum + map_key(m, i)
+  n = n + 1
+  i = map_iter(m, i + 1)
+}
+print "keys=", n, " sum=", sum
+print map_get(m, 4), " ", map_get(m, 3)
+map_free(m)
+
+# a large map
+m = map_new(500)
+i = 0
+while i < 2000 {
+  map_set(m, i * 7919, i)
+  i = i + 1
+}
+i = 0
+while i < 2000 {
+  map_del(m, i * 7919)
+  i = i + 2
+}
+i = 1
+n = 0
+while i < 2000 {
+  if map_get(m, i * 7919) = i {
+    n = n + 1
+  }
+  i = i + 2
+}
+print "size=", map_size(m), " found=", n
+map_free(m)
@@ -0,0 +1,32 @@
+# packed arrays store 8, 16 or 32 bit elements
+array8 b(5) = 1, 255, 256, -1
+array16 h(3) = 1000, 65535, 65536
+array32 w(2) = 0x7fffffff, -5
+
+print "b: ", b(0), " ", b(1), " ", b(2), " ", b(3), " ", b(4)
+print "h: ", h(0), " ", h(1), " ", h(2)
+print "w: ", w(0), " ", w(1)
+
+# the length is still at index -1
+print "lengths: ", b(-1), " ", h(-1), " ", w(-1)
+
+b(4) = 'x'
+print "b(4) = ", b(4)
+
+# packed arrays keep their element size when passed to functions
+func total(a) {
+	array a
+	var i = 0
+	var t = 0
+	while i < a(-1) {
+		t = t + a(i)
+		i = i + 1
+	}
+	return t
+}
+print "total of h = ", total(h)
+
+# library functions only accept arrays of full size values
+print "array_sum(b) = ", array_sum(b)
+
+b(5) = 1
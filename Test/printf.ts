@@ -0,0 +1,44 @@
+# formatted output with string and list formats
+printf("plain %d\n", 42)
+printf_("%5d|%-5d|\n", 7, -7)
+printf__("%x %X %o\n", 255, 255, 8)
+printf_("%05d %+d\n", 42, 42)
+printf_("%c%c\n", 'o', 'k')
+printf("100%% done %d\n", 1)
+printf("bad %q %d\n", 3)
+printf_("[%s] [%6s]\n", "abc", "abc")
+printf_("[%-6s] [%.2s]\n", "abc", "abc")
+var n = printf("%d\n", 12345)
+print "written=", n
+printf("missing %d %d\n", 1)
+
+# the same format used repeatedly
+var i = 0
+while i < 3 {
+  printf_("row %d of %d\n", i, 3)
+  i = i + 1
+}
+
+# list formats notice changes to the list
+var fmt = list_new(8)
+list_push__(fmt, 'a', '=', '%')
+list_push_(fmt, 'd', '\n')
+printf(fmt, 1)
+list_set(fmt, 0, 'b')
+printf(fmt, 2)
+list_set(fmt, 3, 'x')
+printf(fmt, 255)
+printf_("%s and %s\n", fmt, "more")
+list_free(fmt)
+
+# long formats are not cached but still work
+printf("................................................................................%d\n", 9)
+
+# printf takes any number of values
+printf("%d %d %d %d %d %d\n", 1, 2, 3, 4, 5, 6)
+printf("no values\n")
+printf("%d-%d-%d-%d\n", 10, dsqr(3, 4), printf("nested "), 13)
+
+# %s prints anything which is not a string or list as a number
+printf("%s|%4s|%-4s|%s\n", 5, 12, -7, 0)
+print "printf(5) wrote ", printf(5)
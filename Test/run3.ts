@@ -36,3 +36,8 @@ print in_if(11)
 print outer(445)
 print outer(in_if(4))
 print in_if(outer(1))
+
+# a statement after a return may be the last thing in the function
+func one_line(x) { if x < 10 { return x }; return 42 }
+print one_line(3)
+print one_line(30)
@@ -23,4 +23,148 @@ do
 	endmsg="TEST FAILURES"
     fi
 done
+
+#
+# run the tests again with comments and white space stripped, as
+# they would be in an image made with --xip (except for tests which
+# show errors, since the line printed with the error is different)
+#
+for i in *.ts
+do
+    j=`basename $i .ts`
+    if grep -q "script error" $j.expect
+    then
+	continue
+    fi
+    $PROG --strip $i > $j.txt
+    if diff -ub $j.expect $j.txt
+    then
+	echo $j stripped passed
+	rm -f $j.txt
+    else
+	echo $j stripped failed
+	endmsg="TEST FAILURES"
+    fi
+done
+
+#
+# run the tests again reading the script a page at a time, as a
+# program without room for all of it would (if tstest was built with
+# PAGED_SOURCE defined)
+#
+if $PROG --paged /dev/null > /dev/null
+then
+for i in *.ts
+do
+    j=`basename $i .ts`
+    $PROG --paged $i > $j.txt
+    if diff -ub $j.expect $j.txt
+    then
+	echo $j paged passed
+	rm -f $j.txt
+    else
+	echo $j paged failed
+	endmsg="TEST FAILURES"
+    fi
+done
+fi
+
+#
+# run scripts which use an image compiled from the test of the same
+# name (foo.tsu uses the image of foo.ts)
+#
+for i in *.tsu
+do
+    j=`basename $i .tsu`
+    echo $i ":" $j
+    $PROG --compile $j.tsi $j.ts > /dev/null
+    $PROG --load $j.tsi $i > $j.tsu.txt
+    if diff -ub $j.tsu.expect $j.tsu.txt
+    then
+	echo $j image passed
+	rm -f $j.tsi $j.tsu.txt
+    else
+	echo $j image failed
+	endmsg="TEST FAILURES"
+    fi
+done
+#
+# run scripts twice from checkpoints, first of the test of the same
+# name (foo.tsr starts from the state foo.ts leaves) and then of the
+# state the first run leaves
+#
+for i in *.tsr
+do
+    j=`basename $i .tsr`
+    echo $i ":" $j
+    $PROG --checkpoint $j.tsc $j.ts > /dev/null
+    $PROG --restore $j.tsc --checkpoint $j.2.tsc $i > $j.tsr.txt
+    $PROG --restore $j.2.tsc $i >> $j.tsr.txt
+    if diff -ub $j.tsr.expect $j.tsr.txt
+    then
+	echo $j checkpoint passed
+	rm -f $j.tsc $j.2.tsc $j.tsr.txt
+    else
+	echo $j checkpoint failed
+	endmsg="TEST FAILURES"
+    fi
+done
+#
+# test the parts of the C interface which scripts cannot reach
+#
+./apitest > apitest.txt
+if diff -ub apitest.expect apitest.txt
+then
+    echo apitest passed
+    rm -f apitest.txt
+else
+    echo apitest failed
+    endmsg="TEST FAILURES"
+fi
+
+#
+# and the C++ interface
+#
+./hpptest > hpptest.txt
+if diff -ub hpptest.expect hpptest.txt
+then
+    echo hpptest passed
+    rm -f hpptest.txt
+else
+    echo hpptest failed
+    endmsg="TEST FAILURES"
+fi
+
+#
+# send scripts and function calls to a server whose contexts start with
+# the definitions made by server.ts; the requests on one connection
+# share a context, and the next connection gets a fresh one
+#
+SOCK=server$$.sock
+$PROG --serve $SOCK server.ts > /dev/null &
+SERVER=$!
+$PROG --client $SOCK server.tss "bump()" server.tss "twice(21)" "square(12)" "nosuch()" "square(1,2)" > server.tss.txt
+$PROG --client $SOCK "bump()" "twice(1)" >> server.tss.txt
+# lists made on a connection last until it closes, and after the
+# first connection (which interns the script's strings) connections
+# leave nothing allocated behind
+$PROG --client $SOCK "keeplist()" "showkeep()" serverlists.tss > serverlists.tss.txt
+$PROG --client $SOCK "newblocks()" > /dev/null
+$PROG --client $SOCK serverlists.tss "keeplist()" serverlists.tss "showkeep()" >> serverlists.tss.txt
+$PROG --client $SOCK "newblocks()" >> serverlists.tss.txt
+$PROG --client $SOCK serverlists.tss >> serverlists.tss.txt
+$PROG --client $SOCK "newblocks()" >> serverlists.tss.txt
+kill $SERVER
+rm -f $SOCK
+for j in server serverlists
+do
+    if diff -ub $j.tss.expect $j.tss.txt
+    then
+	echo $j passed
+	rm -f $j.tss.txt
+    else
+	echo $j failed
+	endmsg="TEST FAILURES"
+    fi
+done
 echo $endmsg
@@ -0,0 +1,23 @@
+# definitions for the server test; runtests.sh starts a server whose
+# contexts begin with these, and sends server.tss to it
+var count = 0
+func square(x) {
+  return x*x
+}
+func bump() {
+  count = count + 1
+  return count
+}
+# a list kept by one request for the next on the same connection
+var keep = 0
+func keeplist() {
+  keep = list_new(4)
+  list_push(keep, 7)
+  return list_size(keep)
+}
+func showkeep() {
+  var other = list_new(4)
+  list_push_(other, 55, 66)
+  return list_get(keep, 0) * 10 + list_size(keep)
+}
+print "square(3) is ", square(3)
@@ -48,3 +48,22 @@ list_push__(format, 'x', '%', 'd')
 list_push(format, '\n')
 printf(format, 42)
 
+
+# lists of wider elements grow when they are full
+var wide = list_new_width(2, 0)
+list_push__(wide, 1000, -7, 100000)
+print list_size(wide), " ", list_get(wide, 0), " ", list_get(wide, 1), " ", list_get(wide, 2)
+var half = list_new_width(1, 16)
+list_push_(half, 70000, 65535)
+print list_get(half, 0), " ", list_get(half, 1)
+
+# append one list to another in place
+list_append(wide, half)
+print list_size(wide), " ", list_pop(wide), " ", list_pop(wide)
+list_free(half)
+list_free(wide)
+
+# builtins which return nothing give 0
+var tmp = list_new(4)
+list_push(tmp, 1)
+print list_truncate(tmp, 0), " ", list_free(tmp)
@@ -0,0 +1,29 @@
+# interned strings
+var a = "hello"
+var b = "hello"
+var c = "world"
+print "len=", str_len(a), " eq=", str_eq(a, b), " same=", a = b, " ne=", str_eq(a, c)
+print "get=", str_get(c, 0), " ", str_get(c, 4), " out=", str_get(c, 5)
+print "escape=", str_len("a\tb\n"), " ", str_get("a\tb\n", 3)
+
+# strings made at run time are compared by contents
+var ab = str_cat(a, c)
+var ab2 = str_cat(a, c)
+print "cat len=", str_len(ab), " eq=", str_eq(ab, ab2), " same=", ab = ab2
+print "eq literal=", str_eq(ab, "helloworld"), " interned same=", str_intern(ab) = "helloworld"
+str_free(ab)
+str_free(ab2)
+
+# conversion to and from byte lists
+var l = str_to_list(c)
+print "list size=", list_size(l), " ", list_get(l, 1)
+list_set(l, 0, 'W')
+var w = str_from_list(l)
+print "from list=", str_get(w, 0), " eq=", str_eq(w, "World")
+str_free(w)
+list_free(l)
+
+func greet(s) {
+  return str_len(s)
+}
+print "arg=", greet("tinyscript")
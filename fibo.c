@@ -1,9 +1,18 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "tinyscript.h"
+// fibo.h is made by "tstest --xip fibo_ts fibo.ts"; the script is a
+// constant array which runs where it is, so only the variables take
+// up RAM
 #include "fibo.h"
 
+#ifdef __propeller__
 #include <propeller.h>
+#else
+// on other machines (for testing) pretend to be a Propeller
+#include <time.h>
+#define CLOCK_FREQ 80000000
+#endif
 #define ARENA_SIZE 4096
 
 int inchar() {
@@ -13,6 +22,7 @@ void outchar(int c) {
     putchar(c);
 }
 
+#ifdef __propeller__
 static Val getcnt_fn()
 {
 #ifdef CNT
@@ -51,15 +61,43 @@ static Val pinin_fn(Val pin)
     return (INA & mask) ? 1 : 0;
 #endif
 }
+#else
+static Val pins;
+
+static Val getcnt_fn()
+{
+    return (Val)(clock() * ((double)CLOCK_FREQ / CLOCKS_PER_SEC));
+}
+static Val waitcnt_fn(Val when)
+{
+    while (getcnt_fn() - when < 0)
+        ;
+    return when;
+}
+static Val pinout_fn(Val pin, Val onoff)
+{
+    if (onoff) {
+        pins |= (Val)1 << pin;
+    } else {
+        pins &= ~((Val)1 << pin);
+    }
+    return onoff;
+}
+static Val pinin_fn(Val pin)
+{
+    return (pins >> pin) & 1;
+}
+#endif
 
 struct def {
     const char *name;
     intptr_t val;
+    int nargs;
 } fdefs[] = {
-    { "getcnt",    (intptr_t)getcnt_fn },
-    { "pinout",    (intptr_t)pinout_fn },
-    { "pinin",     (intptr_t)pinin_fn },
-    { "waitcnt",   (intptr_t)waitcnt_fn },
+    { "getcnt",    (intptr_t)getcnt_fn, 0 },
+    { "pinout",    (intptr_t)pinout_fn, 2 },
+    { "pinin",     (intptr_t)pinin_fn, 1 },
+    { "waitcnt",   (intptr_t)waitcnt_fn, 1 },
     { NULL, 0 }
 };
 
@@ -74,7 +112,7 @@ main(int argc, char **argv)
     printf("fibo test program\n");
     err = TinyScript_Init(memarena, sizeof(memarena));
     for (i = 0; fdefs[i].name; i++) {
-        err |= TinyScript_Define(fdefs[i].name, BUILTIN, fdefs[i].val);
+        err |= TinyScript_Define(fdefs[i].name, CFUNC(fdefs[i].nargs), fdefs[i].val);
     }
     if (err != 0) {
         printf("Initialization of interpreter failed!\n");
@@ -1,6 +1,6 @@
 #include <stdio.h>
-#include <stdarg.h>
 #include <stdlib.h>
+#include <string.h>
 #ifdef READLINE
 #include <readline/readline.h>
 #include <readline/history.h>
@@ -11,76 +11,931 @@
 #include "tinyscript.h"
 #include "tinyscript_lib.h"
 
+#if defined(__unix__) || defined(__APPLE__)
+#define MMAP_FILES
+#define SERVER_MODE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#endif
+
 #ifdef __propeller__
 #include <propeller.h>
 #define ARENA_SIZE 2048
+#define BUILTINS_SIZE 1536
 #else
 #define ARENA_SIZE 8192
-#define MAX_SCRIPT_SIZE 100000
+#define BUILTINS_SIZE 4096
+#define SCRIPT_FILES
+#endif
+
+#ifdef SERVER_MODE
+// the output of a request to the server is captured to send back
+static int capturing;
+static void capture(const char *buf, size_t len);
 #endif
 
 int inchar() {
     return getchar();
 }
 void outchar(int c) {
+#ifdef SERVER_MODE
+    if (capturing) {
+        char ch = c;
+        capture(&ch, 1);
+        return;
+    }
+#endif
     putchar(c);
 }
 
+// the number of blocks from ts_malloc not yet freed
+static Val heapblocks;
+
 void * ts_malloc(Val size) {
-  return malloc(size);
+  void * p = malloc(size);
+  if (p) heapblocks++;
+  return p;
 }
 
 void ts_free(void * pointer) {
+  if (pointer) heapblocks--;
   free(pointer);
 }
 
-void _ts_printf(ts_list *format, ...) {
-  va_list args;
-  va_start(args, format);
-  char *format_string = ts_list_to_string(format);
-  vprintf(format_string, args);
-  ts_free(format_string);
+static void write_output(const char *buf, Val len) {
+#ifdef SERVER_MODE
+  if (capturing) {
+    capture(buf, len);
+    return;
+  }
+#endif
+  fwrite(buf, 1, len, stdout);
+}
+
+#ifdef SCRIPT_FILES
+// get the contents of a file, which are not to be changed; the file
+// is mapped into memory read-only where possible rather than copied,
+// and stays there for as long as the program runs
+static const char *
+mapfile(const char *filename, long *sizep)
+{
+#ifdef MMAP_FILES
+    struct stat st;
+    void *p;
+    int fd = open(filename, O_RDONLY);
+
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        perror(filename);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return NULL;
+    }
+    *sizep = st.st_size;
+    if (st.st_size == 0) {
+        close(fd);
+        return "";
+    }
+    p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        perror(filename);
+        return NULL;
+    }
+    return p;
+#else
+    FILE *f = fopen(filename, "rb");
+    char *p;
+    long size;
+
+    if (!f) {
+        perror(filename);
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    p = malloc(size + 1);
+    if (!p || fread(p, 1, size, f) != (size_t)size) {
+        fclose(f);
+        free(p);
+        fprintf(stderr, "File read error on %s\n", filename);
+        return NULL;
+    }
+    fclose(f);
+    *sizep = size;
+    return p;
+#endif
+}
+
+// --strip runs the script with comments and white space removed;
+// --xip prints it that way as a constant C array called xipname
+static int stripping;
+static const char *xipname;
+
+// characters which may appear next to each other in one token
+static int
+isidchar(int c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || (c && strchr(".:_", c));
+}
+
+static int
+needspace(int prev, int next)
+{
+    if (isidchar(prev) && isidchar(next)) {
+        return 1;
+    }
+    // operators made of several characters, like <=
+    return prev && next && strchr("+-!/*%=<>&|^", prev) && strchr("=<>&|^", next);
+}
+
+// whether a {} string at "out" is text (to print, say) rather than
+// code (the body of a function, if or while), in which case it has to
+// be kept as it is
+static int
+textbraces(const char *start, const char *out)
+{
+    const char *word = out;
+
+    if (out == start || strchr(",(+-!/*%=<>&|^", out[-1])) {
+        return 1;
+    }
+    while (word > start && isidchar(word[-1])) {
+        word--;
+    }
+    return out - word == 5 && !strncmp(word, "print", 5) && (word == start || !isidchar(word[-1]));
+}
+
+// remove the comments and white space which a script does not need,
+// leaving a smaller one which runs the same way; dst may be src
+static int
+stripscript(char *dst, const char *src)
+{
+    char *out = dst;
+    char *keep = dst;  // output before here must stay as it is
+    const char *end;
+    int depth = 0;     // nesting of {}
+    int space = 0;     // white space was skipped
+    int c;
+
+    while ((c = *src) != 0) {
+        if (c == ' ' || c == '\t' || c == '\r') {
+            space = 1;
+            src++;
+            continue;
+        }
+        if (c == '#') {
+            end = strchr(src, '\n');
+            end = end ? end + 1 : src + strlen(src);
+            // braces in a comment still count when finding the end of
+            // the {} around it, so such a comment has to stay
+            if (depth > 0 && (memchr(src, '{', end - src) || memchr(src, '}', end - src))) {
+                if (out > dst && out[-1] != '\n') {
+                    *out++ = ' ';
+                }
+                memmove(out, src, end - src);
+                out += end - src;
+                keep = out;
+            } else if (end[-1] == '\n') {
+                end--;
+            }
+            src = end;
+            space = 0;
+            continue;
+        }
+        if (space && out > dst && needspace(out[-1], c)) {
+            *out++ = ' ';
+        }
+        space = 0;
+        src++;
+        if (c == '\n') {
+            // blank lines, and new lines at the start or end of {}, do
+            // nothing
+            if (out > dst && out[-1] != '\n' && out[-1] != '{') {
+                *out++ = c;
+            }
+        } else if (c == '"') {
+            *out++ = c;
+            while ((c = *src) != 0) {
+                *out++ = c;
+                src++;
+                if (c == '"' || c == '\n') {
+                    break;
+                }
+            }
+            keep = out;
+        } else if (c == '\'') {
+            *out++ = c;
+            if (*src == '\\' && src[1]) {
+                *out++ = *src++;
+            }
+            if (*src) {
+                *out++ = *src++;
+            }
+            if (*src == '\'') {
+                *out++ = *src++;
+            }
+            keep = out;
+        } else {
+            if (c == '}') {
+                --depth;
+                if (out > keep && out[-1] == '\n') {
+                    --out;
+                }
+            } else if (c == '{') {
+                if (textbraces(dst, out)) {
+                    int n = 1;
+                    *out++ = c;
+                    while (n > 0 && (c = *src) != 0) {
+                        n += (c == '{') - (c == '}');
+                        *out++ = c;
+                        src++;
+                    }
+                    keep = out;
+                    continue;
+                }
+                ++depth;
+            }
+            *out++ = c;
+        }
+    }
+    *out = 0;
+    return out - dst;
+}
+
+// print a stripped script as C source for a constant array, which a
+// program can run where it is (in flash, say) with TinyScript_Run
+static void
+writexip(const char *name, const char *text)
+{
+    int c;
+
+    printf("/* made by tstest --xip; run with TinyScript_Run(%s, 0, 0) */\n", name);
+    printf("const char %s[] =\n\"", name);
+    while ((c = *text++) != 0) {
+        if (c == '\n') {
+            printf("\\n\"\n\"");
+        } else if (c == '\t') {
+            printf("\\t");
+        } else if (c == '"' || c == '\\') {
+            printf("\\%c", c);
+        } else if (c < ' ' || c > '~') {
+            printf("\\%03o", c & 0xff);
+        } else {
+            putchar(c);
+        }
+    }
+    printf("\";\n");
+}
+
+#ifdef IMAGE_SUPPORT
+// if set, the definitions made by the script are written here
+static const char *imagename;
+
+static int
+writeimage(const char *filename)
+{
+    int size = TinyScript_WriteImage(NULL, 0);
+    void *buf = malloc(size);
+    FILE *f;
+    int r = -1;
+
+    if (buf && TinyScript_WriteImage(buf, size) == size && (f = fopen(filename, "wb")) != NULL) {
+        if (fwrite(buf, 1, size, f) == (size_t)size) {
+            r = 0;
+        }
+        if (fclose(f) != 0) {
+            r = -1;
+        }
+    }
+    if (r != 0) {
+        perror(filename);
+    }
+    free(buf);
+    return r;
+}
+
+// load an image file into the interpreter; processes loading the
+// same file share its pages
+static int
+loadimage(const char *filename)
+{
+    long size;
+    const char *image = mapfile(filename, &size);
+    int r;
+
+    if (!image) {
+        return -1;
+    }
+    r = TinyScript_LoadImage(image, size);
+    if (r != 0) {
+        fprintf(stderr, "%s: cannot load image (error %d)\n", filename, r);
+    }
+    return r;
 }
+#endif
 
-void ts_printf(ts_list *format, Val a) {
-  _ts_printf(format, a);
+#ifdef CHECKPOINT_SUPPORT
+// if set, the state left by the script is checkpointed here
+static const char *checkpointname;
+
+static int
+checkpoint(const char *filename)
+{
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int r;
+
+    if (fd < 0) {
+        perror(filename);
+        return -1;
+    }
+    r = TinyScript_Checkpoint(fd);
+    if (close(fd) != 0 && r == 0) {
+        r = TS_ERR_IO;
+    }
+    if (r != 0) {
+        fprintf(stderr, "%s: cannot write checkpoint (error %d)\n", filename, r);
+    }
+    return r;
 }
 
-void ts_printf_(ts_list *format, Val a, Val b) {
-  _ts_printf(format, a, b);
+// restore the state saved in a checkpoint before the script runs
+static int
+restore(const char *filename)
+{
+    int fd = open(filename, O_RDONLY);
+    int r;
+
+    if (fd < 0) {
+        perror(filename);
+        return -1;
+    }
+    r = TinyScript_Restore(fd);
+    close(fd);
+    if (r != 0) {
+        fprintf(stderr, "%s: cannot restore checkpoint (error %d)\n", filename, r);
+    }
+    return r;
 }
+#endif
+
+#ifdef PAGED_SOURCE
+// --paged reads the script from the file a page at a time while it
+// runs, as a program with no room for the whole script (reading it
+// from an SD card, say) would
+static int paging;
+
+static int
+readpage(void *arg, unsigned long at, char *buf, int n)
+{
+    FILE *f = (FILE *)arg;
 
-void ts_printf__(ts_list *format, Val a, Val b, Val c) {
-  _ts_printf(format, a, b, c);
+    if (fseek(f, at, SEEK_SET) != 0) {
+        return -1;
+    }
+    return fread(buf, 1, n, f);
 }
 
-#ifdef MAX_SCRIPT_SIZE
-char script[MAX_SCRIPT_SIZE];
+// the file is left open, since functions defined by the script are
+// read from it when they are called
+static int
+runpaged(const char *filename)
+{
+    FILE *f = fopen(filename, "rb");
+    long size;
+
+    if (!f || fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) < 0) {
+        perror(filename);
+        exit(1);
+    }
+    TinyScript_SetSource(readpage, f);
+    return TinyScript_RunSource(size, 1);
+}
+#endif
 
 void
 runscript(const char *filename)
 {
-    FILE *f = fopen(filename, "r");
+    long size;
+    const char *script;
+    char *copy;
     int r;
-    if (!f) {
-        perror(filename);
-        return;
+
+#ifdef PAGED_SOURCE
+    if (paging) {
+        r = runpaged(filename);
+        goto done;
     }
-    r=fread(script, 1, MAX_SCRIPT_SIZE, f);
-    fclose(f);
-    if (r <= 0) {
-        fprintf(stderr, "File read error on %s\n", filename);
+#endif
+    script = mapfile(filename, &size);
+    if (!script) {
         return;
     }
-    script[r] = 0;
-    r = TinyScript_Run(script, 0, 1);
+    if (xipname || stripping) {
+        // the file itself is read-only, so strip a copy
+        copy = malloc(size + 1);
+        if (!copy) {
+            fprintf(stderr, "Out of memory for %s\n", filename);
+            return;
+        }
+        memcpy(copy, script, size);
+        copy[size] = 0;
+        size = stripscript(copy, copy);
+        script = copy;
+        if (xipname) {
+            writexip(xipname, script);
+            exit(0);
+        }
+    }
+#ifdef TS_LIB_REGION
+    ts_region_begin();
+#endif
+    r = TinyScript_RunBuffer(script, size, 0, 1);
+#ifdef TS_LIB_REGION
+    ts_region_end();
+#endif
+#ifdef PAGED_SOURCE
+done:
+#endif
     if (r != 0) {
         printf("script error %d\n", r);
     }
+#ifdef IMAGE_SUPPORT
+    if (r == 0 && imagename) {
+        r = writeimage(imagename);
+    }
+#endif
+#ifdef CHECKPOINT_SUPPORT
+    if (r == 0 && checkpointname) {
+        r = checkpoint(checkpointname);
+    }
+#endif
     exit(r);
 }
 #endif
 
+#ifdef SERVER_MODE
+//
+// server mode: tstest --serve path [prelude.ts] listens on the Unix
+// socket "path". Each connection is given a context of its own from a
+// pool started from a snapshot of the context made by the prelude, so
+// a request pays neither for setting up the interpreter nor for
+// parsing the prelude. The requests on a connection share its context,
+// and a client may send many of them without waiting for the replies,
+// which come back in order. The requests are
+//
+//   run <len>\n<len bytes of script>
+//   call <name> <args...>\n
+//
+// and the reply to each is
+//
+//   <error> <value> <len>\n<len bytes of output>
+//
+// where value is the result of a call (0 for run). Library objects
+// (lists, maps and strings) made on a connection are allocated in a
+// region of its own, so they last as long as its context does, and are
+// freed together when the connection closes.
+//
+#define SERVER_CONTEXTS 8
+#define MAX_REQUEST 65536  // longest script, and most output kept
+#define MAX_LINE 256       // longest request line
+
+struct buffer {
+    char *data;
+    size_t len;
+    size_t size;
+};
+
+struct conn {
+    int fd;          // -1 if the context is free
+    int eof;         // no more requests will be read
+    size_t sent;     // bytes of out already sent
+    struct buffer in;
+    struct buffer out;
+    ContextState state;
+#ifdef TS_LIB_REGION
+    ts_region_state region;
+#endif
+    Val mem[ARENA_SIZE / sizeof(Val)];
+};
+
+static const char *servepath;
+static const char *clientpath;
+static struct conn conns[SERVER_CONTEXTS];
+static void *snapshot;
+static struct buffer captured;
+#ifdef TS_LIB_REGION
+// no region is open outside of a connection
+static ts_region_state noregion;
+#endif
+
+// add n bytes to a buffer; returns -1 if out of memory
+static int
+bufadd(struct buffer *b, const void *data, size_t n)
+{
+    size_t size = b->size ? b->size : 256;
+    char *p;
+
+    while (size < b->len + n) {
+        size *= 2;
+    }
+    if (size != b->size) {
+        p = realloc(b->data, size);
+        if (!p) {
+            return -1;
+        }
+        b->data = p;
+        b->size = size;
+    }
+    memcpy(b->data + b->len, data, n);
+    b->len += n;
+    return 0;
+}
+
+static void
+capture(const char *buf, size_t len)
+{
+    if (captured.len + len <= MAX_REQUEST) {
+        bufadd(&captured, buf, len);
+    }
+}
+
+// give a connection's context a fresh start from the snapshot, so that
+// it is ready before the next connection needs it
+static int
+freeconn(struct conn *c)
+{
+    if (c->fd >= 0) {
+        close(c->fd);
+    }
+    c->fd = -1;
+    c->in.len = c->out.len = c->sent = 0;
+#ifdef TS_LIB_REGION
+    ts_region_switch(&c->region);
+    ts_region_end();
+    ts_region_begin();
+    ts_region_save(&c->region);
+    ts_region_switch(&noregion);
+#endif
+    if (TinyScript_Clone(snapshot, c->mem, sizeof(c->mem)) != 0) {
+        return -1;
+    }
+    TinyScript_SaveContext(&c->state);
+    return 0;
+}
+
+// run the request at the start of a connection's input, and queue the
+// reply; returns the number of bytes of input used, 0 if the request
+// is not all there yet, or -1 if it is not a valid request
+static long
+dorequest(struct conn *c)
+{
+    char line[MAX_LINE + 1];
+    char *nl = memchr(c->in.data, '\n', c->in.len);
+    char *name, *arg;
+    char head[64];
+    Val args[MAX_BUILTIN_PARAMS];
+    Val value = 0;
+    unsigned long len;
+    long used;
+    int nargs = 0;
+    int err;
+
+    if (!nl) {
+        return c->in.len > MAX_LINE ? -1 : 0;
+    }
+    used = nl - c->in.data;
+    if (used > MAX_LINE) {
+        return -1;
+    }
+    memcpy(line, c->in.data, used);
+    line[used++] = 0;
+    capturing = 1;
+    if (sscanf(line, "run %lu", &len) == 1) {
+        if (len > MAX_REQUEST) {
+            capturing = 0;
+            return -1;
+        }
+        if (c->in.len - used < len) {
+            capturing = 0;
+            return 0;
+        }
+        // the input buffer is used again, so the script's names and
+        // function bodies have to be saved
+        err = TinyScript_RunBuffer(c->in.data + used, len, 1, 1);
+        used += len;
+    } else if (!strncmp(line, "call ", 5) && (name = strtok(line + 5, " ")) != NULL) {
+        err = TS_ERR_OK;
+        while ((arg = strtok(NULL, " ")) != NULL) {
+            if (nargs == MAX_BUILTIN_PARAMS) {
+                err = TS_ERR_TOOMANYARGS;
+                break;
+            }
+            args[nargs++] = strtol(arg, NULL, 0);
+        }
+        if (err == TS_ERR_OK) {
+            err = TinyScript_Call(TinyScript_Lookup(name), args, nargs, &value);
+        }
+    } else {
+        capturing = 0;
+        return -1;
+    }
+    capturing = 0;
+    snprintf(head, sizeof(head), "%d %ld %lu\n", err, (long)value, (unsigned long)captured.len);
+    err = bufadd(&c->out, head, strlen(head)) | bufadd(&c->out, captured.data, captured.len);
+    captured.len = 0;
+    return err ? -1 : used;
+}
+
+// read what a client has sent, and run all the requests which have
+// arrived in full
+static int
+readconn(struct conn *c)
+{
+    char buf[4096];
+    ssize_t r = read(c->fd, buf, sizeof(buf));
+    long used = 0;
+
+    if (r < 0) {
+        return (errno == EINTR || errno == EAGAIN) ? 0 : -1;
+    }
+    if (r == 0) {
+        c->eof = 1;
+        return 0;
+    }
+    if (bufadd(&c->in, buf, r) != 0) {
+        return -1;
+    }
+    TinyScript_SwitchContext(&c->state);
+#ifdef TS_LIB_REGION
+    ts_region_switch(&c->region);
+#endif
+    while (c->in.len > 0 && (used = dorequest(c)) > 0) {
+        c->in.len -= used;
+        memmove(c->in.data, c->in.data + used, c->in.len);
+    }
+    TinyScript_SaveContext(&c->state);
+#ifdef TS_LIB_REGION
+    ts_region_save(&c->region);
+    ts_region_switch(&noregion);
+#endif
+    if (used < 0) {
+        // the replies so far are sent, and then the connection closed
+        c->eof = 1;
+        c->in.len = 0;
+    }
+    return 0;
+}
+
+static int
+writeconn(struct conn *c)
+{
+    ssize_t r = write(c->fd, c->out.data + c->sent, c->out.len - c->sent);
+
+    if (r < 0) {
+        return (errno == EINTR || errno == EAGAIN) ? 0 : -1;
+    }
+    c->sent += r;
+    if (c->sent == c->out.len) {
+        c->sent = c->out.len = 0;
+    }
+    return 0;
+}
+
+static int
+serve(const char *path, const char *prelude)
+{
+    struct sockaddr_un addr;
+    struct pollfd fds[SERVER_CONTEXTS + 1];
+    struct conn *polled[SERVER_CONTEXTS + 1];
+    struct conn *c, *idle;
+    const char *text;
+    long len;
+    int lfd, fd, i, n, r;
+
+    signal(SIGPIPE, SIG_IGN);
+    // set up the context which the pool starts from
+    if (prelude) {
+        text = mapfile(prelude, &len);
+        if (!text) {
+            return 1;
+        }
+        r = TinyScript_RunBuffer(text, len, 0, 1);
+        if (r != 0) {
+            printf("script error %d\n", r);
+            return 1;
+        }
+    }
+    n = TinyScript_Snapshot(NULL, 0);
+    snapshot = malloc(n);
+    if (!snapshot || TinyScript_Snapshot(snapshot, n) != n) {
+        fprintf(stderr, "Out of memory for snapshot\n");
+        return 1;
+    }
+    for (i = 0; i < SERVER_CONTEXTS; i++) {
+        conns[i].fd = -1;
+        if (freeconn(&conns[i]) != 0) {
+            fprintf(stderr, "Arena too small for snapshot\n");
+            return 1;
+        }
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "%s: socket path too long\n", path);
+        return 1;
+    }
+    strcpy(addr.sun_path, path);
+    lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path);
+    if (lfd < 0 || bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(lfd, SERVER_CONTEXTS) != 0) {
+        perror(path);
+        return 1;
+    }
+
+    for(;;) {
+        n = 0;
+        idle = NULL;
+        for (i = 0; i < SERVER_CONTEXTS; i++) {
+            c = &conns[i];
+            if (c->fd < 0) {
+                idle = idle ? idle : c;
+                continue;
+            }
+            fds[n].fd = c->fd;
+            fds[n].events = (c->eof ? 0 : POLLIN) | (c->out.len > c->sent ? POLLOUT : 0);
+            polled[n++] = c;
+        }
+        // new connections wait until there is a context for them
+        if (idle) {
+            fds[n].fd = lfd;
+            fds[n].events = POLLIN;
+            polled[n++] = NULL;
+        }
+        if (poll(fds, n, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            return 1;
+        }
+        for (i = 0; i < n; i++) {
+            c = polled[i];
+            if (!fds[i].revents) {
+                continue;
+            }
+            if (!c) {
+                fd = accept(lfd, NULL, NULL);
+                if (fd >= 0) {
+                    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+                    idle->fd = fd;
+                    idle->eof = 0;
+                }
+                continue;
+            }
+            r = 0;
+            if (!c->eof && (fds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+                r = readconn(c);
+            }
+            if (r == 0 && c->out.len > c->sent) {
+                r = writeconn(c);
+            }
+            if (r != 0 || (c->eof && c->out.len == c->sent) || (fds[i].revents & POLLNVAL)) {
+                if (freeconn(c) != 0) {
+                    return 1;
+                }
+            }
+        }
+    }
+}
+
+static int
+writeall(int fd, const char *buf, size_t len)
+{
+    ssize_t r;
+
+    while (len > 0) {
+        r = write(fd, buf, len);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r <= 0) {
+            return -1;
+        }
+        buf += r;
+        len -= r;
+    }
+    return 0;
+}
+
+//
+// client mode: tstest --client path request... sends its requests to
+// the server at "path" all at once, and then prints the replies. A
+// request like name(1,2) calls a function; anything else is the name
+// of a script file to run
+//
+static int
+client(const char *path, char **reqs, int nreqs)
+{
+    struct sockaddr_un addr;
+    struct buffer out = { NULL, 0, 0 };
+    char line[MAX_LINE + 1];
+    const char *text;
+    FILE *f;
+    long len, value;
+    unsigned long outlen;
+    int fd = -1;
+    int i, j, k, c, err;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "%s: socket path too long\n", path);
+        return 1;
+    }
+    strcpy(addr.sun_path, path);
+    for (i = 0; i < nreqs; i++) {
+        if (strchr(reqs[i], '(')) {
+            // name(1,2) becomes "call name 1 2"
+            if (strlen(reqs[i]) > MAX_LINE - 6) {
+                fprintf(stderr, "%s: request too long\n", reqs[i]);
+                return 1;
+            }
+            strcpy(line, "call ");
+            for (j = 0, k = 5; (c = reqs[i][j]) != 0; j++) {
+                if (c != ')') {
+                    line[k++] = (c == '(' || c == ',') ? ' ' : c;
+                }
+            }
+            line[k++] = '\n';
+            err = bufadd(&out, line, k);
+        } else {
+            text = mapfile(reqs[i], &len);
+            if (!text) {
+                return 1;
+            }
+            snprintf(line, sizeof(line), "run %ld\n", len);
+            err = bufadd(&out, line, strlen(line)) | bufadd(&out, text, len);
+        }
+        if (err) {
+            fprintf(stderr, "Out of memory for requests\n");
+            return 1;
+        }
+    }
+
+    // the server may still be starting up
+    for (i = 0; i < 50; i++) {
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+        if (errno != ENOENT && errno != ECONNREFUSED) {
+            break;
+        }
+        usleep(100000);
+    }
+    err = (fd < 0 || writeall(fd, out.data, out.len) != 0);
+    free(out.data);
+    if (err) {
+        perror(path);
+        return 1;
+    }
+    shutdown(fd, SHUT_WR);
+    f = fdopen(fd, "r");
+    for (i = 0; f && i < nreqs; i++) {
+        if (fscanf(f, "%d %ld %lu", &err, &value, &outlen) != 3 || getc(f) != '\n') {
+            fprintf(stderr, "%s: no reply to %s\n", path, reqs[i]);
+            fclose(f);
+            return 1;
+        }
+        while (outlen-- > 0 && (c = getc(f)) != EOF) {
+            putchar(c);
+        }
+        if (strchr(reqs[i], '(')) {
+            printf("%s = %ld\n", reqs[i], value);
+        }
+        if (err != 0) {
+            printf("script error %d\n", err);
+        }
+    }
+    if (f) {
+        fclose(f);
+    }
+    return 0;
+}
+#endif
+
 #ifdef __propeller__
 static Val getcnt_fn()
 {
@@ -120,6 +975,16 @@ static Val testfunc(Val x, Val y)
 {
     return x*x + y*y;
 }
+
+// the number of library blocks allocated and not freed since the
+// last call; used for testing that scripts do not leak
+static Val newblocks(void)
+{
+    static Val last;
+    Val n = heapblocks - last;
+    last = heapblocks;
+    return n;
+}
 #endif
 
 struct def {
@@ -134,9 +999,7 @@ struct def {
     { "pinin",     (intptr_t)pinin_fn, 1 },
 #else
     { "dsqr",      (intptr_t)testfunc, 2 },
-    {"printf",    (intptr_t)ts_printf, 2},
-    {"printf_",   (intptr_t)ts_printf_, 3},
-    {"printf__",  (intptr_t)ts_printf__, 4},
+    { "newblocks", (intptr_t)newblocks, 0 },
 #endif
     { NULL, 0 }
 };
@@ -182,27 +1045,100 @@ REPL()
 }
 
 char memarena[ARENA_SIZE];
+// the builtins are defined once into a table of their own, which
+// leaves all of the arena for scripts
+Val builtinmem[BUILTINS_SIZE / sizeof(Val)];
 
 int
 main(int argc, char **argv)
 {
     int err;
     int i;
+    const BuiltinTable *builtins;
     
-    err = TinyScript_Init(memarena, sizeof(memarena));
+    err = TinyScript_BeginBuiltins(builtinmem, sizeof(builtinmem));
     for (i = 0; funcdefs[i].name; i++) {
         err |= TinyScript_Define(funcdefs[i].name, CFUNC(funcdefs[i].nargs), funcdefs[i].val);
     }
     err |= ts_define_funcs();
-    if (err != 0) {
+    builtins = TinyScript_EndBuiltins();
+    err |= TinyScript_Init(memarena, sizeof(memarena));
+    TinyScript_UseBuiltins(builtins);
+#ifndef __propeller__
+    ts_set_output(write_output);
+#endif
+    if (err != 0 || !builtins) {
         printf("Initialization of interpreter failed!\n");
         return 1;
     }
 #ifdef __propeller__
     REPL();
 #else
+    while (argc > 2 && argv[1][0] == '-') {
+        if (!strcmp(argv[1], "--strip")) {
+            stripping = 1;
+            argc--;
+            argv++;
+            continue;
+#ifdef PAGED_SOURCE
+        } else if (!strcmp(argv[1], "--paged")) {
+            paging = 1;
+            argc--;
+            argv++;
+            continue;
+#endif
+        } else if (!strcmp(argv[1], "--xip")) {
+            xipname = argv[2];
+#ifdef SERVER_MODE
+        } else if (!strcmp(argv[1], "--serve")) {
+            servepath = argv[2];
+        } else if (!strcmp(argv[1], "--client")) {
+            clientpath = argv[2];
+#endif
+#ifdef IMAGE_SUPPORT
+        // --load image.tsi defines the contents of an image before the
+        // script runs; --compile out.tsi saves what the script defines
+        } else if (!strcmp(argv[1], "--load")) {
+            if (loadimage(argv[2]) != 0) {
+                return 1;
+            }
+        } else if (!strcmp(argv[1], "--compile")) {
+            imagename = argv[2];
+#endif
+#ifdef CHECKPOINT_SUPPORT
+        // --restore saved.tsc starts from a checkpoint, and
+        // --checkpoint saved.tsc saves the state the script leaves
+        } else if (!strcmp(argv[1], "--restore")) {
+            if (restore(argv[2]) != 0) {
+                return 1;
+            }
+        } else if (!strcmp(argv[1], "--checkpoint")) {
+            checkpointname = argv[2];
+#endif
+        } else {
+            break;
+        }
+        argc -= 2;
+        argv += 2;
+    }
+#ifdef SERVER_MODE
+    if (servepath) {
+        return serve(servepath, argv[1]);
+    } else if (clientpath) {
+        return client(clientpath, argv + 1, argc - 1);
+    }
+#endif
     if (argc > 2) {
-        printf("Usage: tinyscript [file]\n");
+        printf("Usage: tinyscript [--strip]");
+#ifdef PAGED_SOURCE
+        printf(" [--paged]");
+#endif
+        printf(" [--xip name] [--load image.tsi] [--compile out.tsi] [--restore saved.tsc] [--checkpoint saved.tsc] [file]\n");
+#ifdef SERVER_MODE
+        printf("       tinyscript --serve path [prelude.ts]\n");
+        printf("       tinyscript --client path [file.ts | name(args)]...\n");
+#endif
+        return 1;
     }
     if (argv[1]) {
         runscript(argv[1]);
@@ -38,6 +38,10 @@
 #include <string.h>
 #include <stdlib.h>
 #include "tinyscript.h"
+#ifdef CHECKPOINT_SUPPORT
+#include <errno.h>
+#include <unistd.h>
+#endif
 
 // where our data is stored
 // value stack grows from the top of the area to the bottom
@@ -63,12 +67,136 @@ static int tokenArgs; // number of arguments for this token
 static String token;  // the actual string representing the token
 static Val tokenVal;  // for symbolic tokens, the symbol's value
 static Sym *tokenSym;
+
+// keywords and stock operators
+struct def {
+    const char *name;
+    int toktype;
+    intptr_t val;
+};
+static const struct def *tokenDef;
 static int didReturn = 0;
 
+// handler which gives string literals used in expressions their value
+static Strfunc stringHandler;
+
+#ifdef PAGED_SOURCE
+// a paged source is read through a small cache of pages; strings in it
+// (such as function bodies) hold offsets, and characters are fetched
+// when they are needed, so the script is never all in memory
+#ifndef SOURCE_PAGE_SIZE
+#ifdef SMALL_PTRS
+#define SOURCE_PAGE_SIZE 128
+#define SOURCE_PAGES 4
+#else
+#define SOURCE_PAGE_SIZE 256
+#define SOURCE_PAGES 8
+#endif
+#endif
+// longest token (other than a {} or "" string) in a paged source
+#define MAX_TOKEN_LEN 64
+
+static Pagefunc pageRead;
+static void *pageArg;
+static char pageData[SOURCE_PAGES][SOURCE_PAGE_SIZE];
+static unsigned long pageNum[SOURCE_PAGES];  // page number + 1, 0 if empty
+static int pageLast;  // page used most recently
+static int pageNext;  // page to be replaced next
+
+// get the character at offset "at" of the source
+static int
+PageChar(intptr_t at)
+{
+    unsigned long page = (unsigned long)at / SOURCE_PAGE_SIZE + 1;
+    int i = pageLast;
+    int n;
+
+    if (pageNum[i] != page) {
+        for (i = 0; i < SOURCE_PAGES && pageNum[i] != page; i++)
+            ;
+        if (i == SOURCE_PAGES) {
+            // replace the pages in turn, but never the one in use
+            if (pageNext == pageLast) {
+                pageNext = (pageNext + 1) % SOURCE_PAGES;
+            }
+            i = pageNext;
+            pageNext = (pageNext + 1) % SOURCE_PAGES;
+            n = pageRead ? pageRead(pageArg, (page - 1) * SOURCE_PAGE_SIZE, pageData[i], SOURCE_PAGE_SIZE) : 0;
+            if (n < 0) {
+                n = 0;
+            }
+            // a read error gives 0 characters, which are syntax errors
+            memset(pageData[i] + n, 0, SOURCE_PAGE_SIZE - n);
+            pageNum[i] = page;
+        }
+        pageLast = i;
+    }
+    return pageData[i][at % SOURCE_PAGE_SIZE];
+}
+
+// get the character at "at" in string s, which may be paged
+static inline int
+SourceChar(String s, intptr_t at)
+{
+    return StringIsPaged(s) ? PageChar(at) : *(const char *)at;
+}
+#else
+#define SourceChar(s, at) (*(const char *)(at))
+#endif
+
+#ifdef EXPR_COMPILE
+// maximum number of variables and stack depth of a compiled expression
+#define MAX_EXPR_SLOTS 16
+#define MAX_EXPR_STACK 16
+// number of rows at a time processed by batch evaluation
+#define EXPR_BATCH_ROWS 32
+
+// compiled expressions are kept as a list of (opcode, argument) pairs
+// which are interpreted with a small stack
+enum {
+    XOP_END,
+    XOP_CONST,   // push argument
+    XOP_SLOT,    // push binding number argument
+    XOP_BINOP,   // apply operator function in argument to top 2 values;
+                 // batch kernel number in high bits
+    XOP_CALL,    // call builtin in argument; number of args in high bits
+    XOP_VARCALL, // call variadic builtin in argument; number of args in high bits
+    XOP_USRFUNC, // call user function in argument
+};
+
+struct compiled_expr {
+    int ncode;        // number of words of code
+    int nslots;       // number of variable bindings
+    int depth;        // deepest the evaluation stack gets
+    Val *code;
+    String *slotName; // names of the variables
+};
+
+// state for compiling
+#define COMPILE_EXPR  1  // compiling for TinyScript_CompileExpr
+#define COMPILE_ARRAY 2  // compiling a whole array assignment
+static int compiling;
+static Val *codeptr;
+static int codeDepth;
+static int codeMaxDepth;
+static int codeSlots;
+static String codeSlotName[MAX_EXPR_SLOTS];
+#ifdef ARRAY_SUPPORT
+static Val *codeArray[MAX_EXPR_SLOTS];
+#endif
+#define Compiling() (compiling)
+#else
+#define Compiling() (0)
+#define EmitConst(v) TS_ERR_OK
+#endif
+
 #ifdef ARRAY_SUPPORT
 static int ParseArrayDef(int saveStrings);
 static int ParseArrayGet(Val *vp);
 static int ParseArraySet();
+#ifdef EXPR_COMPILE
+static int ParseOnce(Val *vp);
+#endif
 #endif
 
 // compare two Strings for equality
@@ -99,10 +227,10 @@ void
 PrintString(String s)
 {
     unsigned len = StringGetLen(s);
-    const char *ptr = (const char *)StringGetPtr(s);
+    intptr_t at = (intptr_t)StringGetPtr(s);
     while (len > 0) {
-        outchar(*ptr);
-        ptr++;
+        outchar(SourceChar(s, at));
+        at++;
         --len;
     }
 }
@@ -146,6 +274,55 @@ PrintNumber(Val v)
     }
 }
 
+// builtins shared between contexts are kept in a frozen table with
+// a hash index, which is searched after the symbols in the arena
+struct builtin_table {
+    int nsyms;
+    unsigned mask;  // size of index - 1
+    Sym *syms;
+    int *index;     // symbol numbers, -1 for an empty slot
+};
+
+static const BuiltinTable *builtins;
+
+static unsigned
+HashString(String name)
+{
+    const Byte *ptr = (const Byte *)StringGetPtr(name);
+    unsigned len = StringGetLen(name);
+    unsigned h = 2166136261u;
+
+    while (len-- > 0) {
+        h = (h ^ *ptr++) * 16777619u;
+    }
+    return h;
+}
+
+static Sym *
+LookupBuiltin(String name)
+{
+    unsigned h;
+    int i;
+
+    if (!builtins) {
+        return NULL;
+    }
+    h = HashString(name) & builtins->mask;
+    while ((i = builtins->index[h]) >= 0) {
+        if (stringeq(builtins->syms[i].name, name)) {
+            return &builtins->syms[i];
+        }
+        h = (h + 1) & builtins->mask;
+    }
+    return NULL;
+}
+
+static int
+IsBuiltinSym(Sym *s)
+{
+    return builtins && s >= builtins->syms && s < builtins->syms + builtins->nsyms;
+}
+
 // look up a symbol by name
 static Sym *
 LookupSym(String name)
@@ -159,7 +336,7 @@ LookupSym(String name)
             return s;
         }
     }
-    return NULL;
+    return LookupBuiltin(name);
 }
 
 static void
@@ -184,16 +361,20 @@ static int charin(int c, const char *str)
 // some functions to print an error and return
 //
 static void ErrorAt() {
-    const char* ptr = StringGetPtr(parseptr);
+    intptr_t at = (intptr_t)StringGetPtr(parseptr);
+    intptr_t end = at + StringGetLen(parseptr);
+    // a paged source starts at offset 0
+    intptr_t start = StringIsPaged(parseptr) ? 0 : (intptr_t)script_buffer;
+    int c;
 	// back up to beginning of statement
-    while (ptr > script_buffer && !charin(*(ptr - 1), ";\n")) {
-        ptr--;
+    while (at > start && !charin(SourceChar(parseptr, at - 1), ";\n")) {
+        at--;
     }
 	outcstr(" in: ");
-	// print until end of statement
-	while (*ptr && !charin(*ptr, ";\n")) {
-		outchar(*ptr);
-		ptr++;
+	// print until end of statement; the script need not end with a 0
+	while (at < end && (c = SourceChar(parseptr, at)) != 0 && !charin(c, ";\n")) {
+		outchar(c);
+		at++;
 	}
 	outchar('\n');
 }
@@ -212,6 +393,13 @@ static int TooManyArgs() {
     ErrorAt();
     return TS_ERR_TOOMANYARGS;
 }
+#ifdef EXPR_COMPILE
+static int TooComplex() {
+    outcstr("expression too complex");
+    ErrorAt();
+    return TS_ERR_TOOCOMPLEX;
+}
+#endif
 static int OutOfMem() {
     outcstr("out of memory");
     ErrorAt();
@@ -221,6 +409,11 @@ static int UnknownSymbol() {
     outcstr(": unknown symbol\n");
     return TS_ERR_UNKNOWN_SYM;
 }
+static int ReadOnly() {
+    outcstr("cannot assign to builtin");
+    ErrorAt();
+    return TS_ERR_READONLY;
+}
 #ifdef ARRAY_SUPPORT
 static int OutOfBounds() {
     outcstr("out of bounds");
@@ -233,7 +426,9 @@ static int OutOfBounds() {
 #define ArgMismatch() TS_ERR_BADARGS
 #define TooManyArgs() TS_ERR_TOOMANYARGS
 #define OutOfMem()    TS_ERR_NOMEM
+#define TooComplex()  TS_ERR_TOOCOMPLEX
 #define UnknownSymbol() TS_ERR_UNKNOWN_SYM
+#define ReadOnly()    TS_ERR_READONLY
 #ifdef ARRAY_SUPPORT
 #define OutOfBounds()   TS_ERR_OUTOFBOUNDS
 #endif
@@ -265,10 +460,22 @@ static int OutOfBounds() {
 #define TOK_SYNTAX_ERR 'Z'
 #define TOK_RETURN 'r'
 
+// set the position and length of a string in the script, keeping the
+// mark of a paged string; positions are worked out as integers, since
+// in a paged source they are offsets rather than pointers
+static void
+SetSpan(String *s, intptr_t at, unsigned len)
+{
+    int paged = StringIsPaged(*s);
+    StringSetPtr(s, (const char *)at);
+    StringSetLen(s, len);
+    StringSetPaged(s, paged);
+}
+
 static void ResetToken()
 {
-    StringSetLen(&token, 0);
-    StringSetPtr(&token, StringGetPtr(parseptr));
+    token = parseptr;
+    SetSpan(&token, (intptr_t)StringGetPtr(parseptr), 0);
 }
 
 //
@@ -279,16 +486,14 @@ GetChar()
 {
     int c;
     unsigned len = StringGetLen(parseptr);
-    const char *ptr;
+    intptr_t at;
     if (len == 0)
         return -1;
-    ptr = StringGetPtr(parseptr);
-    c = *ptr++;
-    --len;
+    at = (intptr_t)StringGetPtr(parseptr);
+    c = SourceChar(parseptr, at);
 
-    StringSetPtr(&parseptr, ptr);
-    StringSetLen(&parseptr, len);
-    StringSetLen(&token, StringGetLen(token)+1);
+    SetSpan(&parseptr, at + 1, len - 1);
+    SetSpan(&token, (intptr_t)StringGetPtr(token), StringGetLen(token)+1);
     return c;
 }
 
@@ -300,22 +505,21 @@ PeekChar(unsigned int n)
 {
   if (StringGetLen(parseptr) <= n)
     return -1;
-  return *(StringGetPtr(parseptr) + n);
+  return SourceChar(parseptr, (intptr_t)StringGetPtr(parseptr) + n);
 }
 
 // remove the last character read from the token
 static void
 IgnoreLastChar()
 {
-    StringSetLen(&token, StringGetLen(token)-1);
+    SetSpan(&token, (intptr_t)StringGetPtr(token), StringGetLen(token)-1);
 }
 
 // remove the last character read from the token
 static void
 IgnoreFirstChar()
 {
-    StringSetPtr(&token, StringGetPtr(token) + 1);
-    StringSetLen(&token, StringGetLen(token)-1);
+    SetSpan(&token, (intptr_t)StringGetPtr(token) + 1, StringGetLen(token)-1);
 }
 //
 // undo last getchar
@@ -323,11 +527,51 @@ IgnoreFirstChar()
 static void
 UngetChar()
 {
-    StringSetLen(&parseptr, StringGetLen(parseptr)+1);
-    StringSetPtr(&parseptr, StringGetPtr(parseptr)-1);
+    SetSpan(&parseptr, (intptr_t)StringGetPtr(parseptr)-1, StringGetLen(parseptr)+1);
     IgnoreLastChar();
 }
 
+#ifdef PAGED_SOURCE
+// tokens read from a paged source (other than {} and "" strings) are
+// copied here, so that the rest of the parser sees ordinary strings;
+// there are two buffers, since a token is sometimes still needed
+// after the next one has been read
+static char tokenbuf[2][MAX_TOKEN_LEN];
+static int tokenflip;
+
+// returns -1 if the token is too long
+static int
+CopyToken()
+{
+    unsigned len = StringGetLen(token);
+    intptr_t at = (intptr_t)StringGetPtr(token);
+    char *buf;
+    unsigned i;
+
+    if (!StringIsPaged(token)) {
+        return 0;
+    }
+    if (len > MAX_TOKEN_LEN) {
+        return -1;
+    }
+    tokenflip ^= 1;
+    buf = tokenbuf[tokenflip];
+    for (i = 0; i < len; i++) {
+        buf[i] = PageChar(at + i);
+    }
+    StringSetPtr(&token, buf);
+    StringSetLen(&token, len);
+    return 0;
+}
+
+// whether a string is in the token buffers, and so has to be copied
+// to be kept
+#define InTokenBuf(s) ((intptr_t)StringGetPtr(s) >= (intptr_t)tokenbuf[0] && (intptr_t)StringGetPtr(s) < (intptr_t)tokenbuf[0] + sizeof(tokenbuf))
+#else
+#define CopyToken() (0)
+#define InTokenBuf(s) (0)
+#endif
+
 // these appear in <ctypes.h> too, but
 // we don't want macros and we don't want to
 // drag in a table of character flags
@@ -392,6 +636,8 @@ isoperatorchar2(int c) {
     return charin(c, "=<>&|^");
 }
 
+static const struct def *LookupKeyword(String name);
+
 static int
 doNextToken(int israw)
 {
@@ -400,6 +646,7 @@ doNextToken(int israw)
     Sym *sym = NULL;
     
     tokenSym = NULL;
+    tokenDef = NULL;
     ResetToken();
     for(;;) {
         c = GetChar();
@@ -411,8 +658,9 @@ doNextToken(int israw)
     }
 
     if (c == '#') {
-        // comment
+        // comment; the token is just the newline at its end
         do {
+            ResetToken();
             c = GetChar();
         } while (c >= 0 && c != '\n');
         r = c;
@@ -442,8 +690,14 @@ doNextToken(int israw)
     } else if ( isalpha(c) ) {
         GetSpan(isidentifier);
         r = TOK_SYMBOL;
+        if (CopyToken() < 0) {
+            r = TOK_SYNTAX_ERR;
         // check for special tokens
-        if (!israw) {
+        } else if (!israw && (tokenDef = LookupKeyword(token)) != NULL) {
+            r = tokenDef->toktype & 0xff;
+            tokenArgs = (tokenDef->toktype >> 8) & 0xff;
+            tokenVal = tokenDef->val;
+        } else if (!israw) {
             tokenSym = sym = LookupSym(token);
             if (sym) {
                 r = sym->type & 0xff;
@@ -460,8 +714,12 @@ doNextToken(int israw)
         }
     } else if (isoperator(c)) {
         GetSpan(isoperatorchar2);
-        tokenSym = sym = LookupSym(token);
-        if (sym) {
+        if (CopyToken() < 0) {
+            r = TOK_SYNTAX_ERR;
+        } else if ((tokenDef = LookupKeyword(token)) != NULL) {
+            r = tokenDef->toktype;
+            tokenVal = tokenDef->val;
+        } else if ((tokenSym = sym = LookupSym(token)) != NULL) {
             r = sym->type;
             tokenVal = sym->value;
         } else {
@@ -473,6 +731,7 @@ doNextToken(int israw)
         while (bracket > 0) {
             c = GetChar();
             if (c < 0) {
+                ResetToken();
                 return TOK_SYNTAX_ERR;
             }
             if (c == '}') {
@@ -487,12 +746,19 @@ doNextToken(int israw)
         ResetToken();
         GetSpan(notquote);
         c = GetChar();
-        if (c < 0) return TOK_SYNTAX_ERR;
+        if (c < 0) {
+            ResetToken();
+            return TOK_SYNTAX_ERR;
+        }
         IgnoreLastChar();
         r = TOK_STRING;
     } else {
         r = c;
     }
+    // {} and "" strings in a paged source are left where they are
+    if (r != TOK_STRING && CopyToken() < 0) {
+        r = TOK_SYNTAX_ERR;
+    }
 #ifdef TSDEBUG
     outcstr("Token[");
     outchar(r & 0xff);
@@ -509,6 +775,14 @@ doNextToken(int israw)
 static int NextToken() { return doNextToken(0); }
 static int NextRawToken() { return doNextToken(1); }
 
+// whether the current token is "="; a {} or "" string never is (and
+// may be in a paged source)
+static int
+IsAssignToken()
+{
+    return curToken != TOK_STRING && StringGetLen(token) == 1 && StringGetPtr(token)[0] == '=';
+}
+
 // push a number on the result stack
 // this stack grows down from the top of the arena
 
@@ -583,6 +857,7 @@ DefineSym(String name, int typ, Val value)
     symptr++;
     if ( (intptr_t)symptr >= (intptr_t)valptr) {
         //out of memory
+        symptr = s;
         return NULL;
     }
     s->name = name;
@@ -618,6 +893,88 @@ TinyScript_Define(const char *name, int typ, Val val)
 
 extern int ParseExpr(Val *result);
 
+#ifdef EXPR_COMPILE
+// emit an instruction for a compiled expression
+// "stack" is the change in evaluation stack depth it causes
+static int
+EmitCode(Val op, Val arg, int stack)
+{
+    if ((intptr_t)(codeptr + 2) > (intptr_t)valptr) {
+        return OutOfMem();
+    }
+    *codeptr++ = op;
+    *codeptr++ = arg;
+    codeDepth += stack;
+    if (codeDepth > codeMaxDepth) {
+        if (codeDepth > MAX_EXPR_STACK) {
+            return TooComplex();
+        }
+        codeMaxDepth = codeDepth;
+    }
+    return TS_ERR_OK;
+}
+
+static int OpKernel(Opfunc op);
+
+// emit an operator; stock operators are tagged with the
+// index of a kernel for batch evaluation
+static int
+EmitOp(Opfunc op)
+{
+    return EmitCode(XOP_BINOP | (OpKernel(op)<<8), (Val)op, -1);
+}
+
+// if compiling, emit a constant
+static int
+EmitConst(Val v)
+{
+    if (!compiling) return TS_ERR_OK;
+    return EmitCode(XOP_CONST, v, 1);
+}
+
+// emit a reference to a variable, allocating a slot for it
+// if this is the first time we have seen it
+static int
+EmitSlot(String name)
+{
+    int i;
+    for (i = 0; i < codeSlots; i++) {
+        if (stringeq(codeSlotName[i], name)) {
+            break;
+        }
+    }
+    if (i == codeSlots) {
+        if (codeSlots >= MAX_EXPR_SLOTS) {
+            return TooComplex();
+        }
+        codeSlotName[codeSlots++] = name;
+    }
+    NextToken();
+    return EmitCode(XOP_SLOT, i, 1);
+}
+
+#ifdef ARRAY_SUPPORT
+// emit a reference to a whole array in an array assignment
+static int
+EmitArray(Val *ary)
+{
+    int i;
+    for (i = 0; i < codeSlots; i++) {
+        if (codeArray[i] == ary) {
+            break;
+        }
+    }
+    if (i == codeSlots) {
+        if (codeSlots >= MAX_EXPR_SLOTS) {
+            return TooComplex();
+        }
+        codeArray[codeSlots++] = ary;
+    }
+    return EmitCode(XOP_SLOT, i, 1);
+}
+#endif
+#endif
+
 // parse an expression list, and push the various results
 // returns the number of items pushed, or a negative error
 static int
@@ -633,9 +990,11 @@ ParseExprList(void)
         if (err != TS_ERR_OK) {
             return err;
         }
-        err = Push(v);
-        if (err != TS_ERR_OK) {
-            return err;
+        if (!Compiling()) {
+            err = Push(v);
+            if (err != TS_ERR_OK) {
+                return err;
+            }
         }
         count++;
         c = curToken;
@@ -665,23 +1024,36 @@ ParseChar(Val *vp, String token)
 }
 
 static int ParseString(String str, int saveStrings, int topLevel);
+static int CallStringHandler(String s, Val *vp);
 
-// parse a function call
-// this may be a builtin (if script == NULL)
-// or a user defined script
+// invoke a user defined function on arguments that have
+// already been evaluated
+static int
+CallUserFunc(UserFunc *uf, const Val *args, Val *vp)
+{
+    // set up an environment for the script
+    int i;
+    int err;
+    Sym* savesymptr = symptr;
+    for (i = 0; i < uf->nargs; i++) {
+        DefineSym(uf->argName[i], INT, args[i]);
+    }
+    didReturn = 0;
+    err = ParseString(uf->body, 0, 0);
+    didReturn = 0;
+    *vp = fResult;
+    symptr = savesymptr;
+    return err;
+}
 
+// parse the parenthesized arguments of a function call, and push them
+// returns the number of arguments, or a negative error
 static int
-ParseFuncCall(Cfunc op, Val *vp, UserFunc *uf)
+ParseCallArgs(void)
 {
     int paramCount = 0;
-    int expectargs;
     int c;
 
-    if (uf) {
-        expectargs = uf->nargs;
-    } else {
-        expectargs = tokenArgs;
-    }
     c = NextToken();
     if (c != '(') return SyntaxError();
     c = NextToken();
@@ -693,10 +1065,77 @@ ParseFuncCall(Cfunc op, Val *vp, UserFunc *uf)
     if (c!=')') {
         return SyntaxError();
     }
+    return paramCount;
+}
+
+// builtins are called with exactly the number of arguments they were
+// defined with, and builtins defined with CPROC return nothing
+typedef Val (*Cfunc0)(void);
+typedef Val (*Cfunc1)(Val);
+typedef Val (*Cfunc2)(Val, Val);
+typedef Val (*Cfunc3)(Val, Val, Val);
+typedef void (*Cproc0)(void);
+typedef void (*Cproc1)(Val);
+typedef void (*Cproc2)(Val, Val);
+typedef void (*Cproc3)(Val, Val, Val);
+typedef void (*Cproc4)(Val, Val, Val, Val);
+
+// call builtin "fn", whose symbol type is "typ", on arguments "a"
+static Val
+CallBuiltin(Val fn, int typ, const Val *a)
+{
+    if (typ & VOIDFUNC) {
+        switch ((typ >> 8) & 0xff) {
+        case 0: ((Cproc0)fn)(); break;
+        case 1: ((Cproc1)fn)(a[0]); break;
+        case 2: ((Cproc2)fn)(a[0], a[1]); break;
+        case 3: ((Cproc3)fn)(a[0], a[1], a[2]); break;
+        default: ((Cproc4)fn)(a[0], a[1], a[2], a[3]); break;
+        }
+        return 0;
+    }
+    switch ((typ >> 8) & 0xff) {
+    case 0: return ((Cfunc0)fn)();
+    case 1: return ((Cfunc1)fn)(a[0]);
+    case 2: return ((Cfunc2)fn)(a[0], a[1]);
+    case 3: return ((Cfunc3)fn)(a[0], a[1], a[2]);
+    default: return ((Cfunc)fn)(a[0], a[1], a[2], a[3]);
+    }
+}
+
+// parse a function call
+// this may be a builtin (if script == NULL)
+// or a user defined script
+
+static int
+ParseFuncCall(Cfunc op, Val *vp, UserFunc *uf)
+{
+    int paramCount;
+    int expectargs;
+    int typ = 0;
+
+    if (uf) {
+        expectargs = uf->nargs;
+    } else {
+        expectargs = tokenArgs;
+        typ = tokenSym->type;
+    }
+    paramCount = ParseCallArgs();
+    if (paramCount < 0) return paramCount;
     // make sure the right number of params is on the stack
     if (expectargs != paramCount) {
         return ArgMismatch();
     }
+#ifdef EXPR_COMPILE
+    if (compiling) {
+        // the arguments have been compiled; now compile the call
+        if (uf) {
+            return EmitCode(XOP_USRFUNC, (Val)uf, 1 - paramCount);
+        }
+        NextToken();
+        return EmitCode(XOP_CALL | (typ & ~0xff), (Val)op, 1 - paramCount);
+    }
+#endif
     // we now have "paramCount" items pushed on to the stack
     // pop em off
     while (paramCount > 0) {
@@ -704,23 +1143,46 @@ ParseFuncCall(Cfunc op, Val *vp, UserFunc *uf)
         fArgs[paramCount] = Pop();
     }
     if (uf) {
-        // need to invoke the script here
-        // set up an environment for the script
-        int i;
-        int err;
-        Sym* savesymptr = symptr;
-        for (i = 0; i < expectargs; i++) {
-            DefineSym(uf->argName[i], INT, fArgs[i]);
-        }
-        didReturn = 0;
-        err = ParseString(uf->body, 0, 0);
-        didReturn = 0;
-        *vp = fResult;
-        symptr = savesymptr;
-        return err;
+        return CallUserFunc(uf, fArgs, vp);
     } else {
-        *vp = op(fArgs[0], fArgs[1], fArgs[2], fArgs[3]);
+        *vp = CallBuiltin((Val)op, typ, fArgs);
+    }
+    NextToken();
+    return TS_ERR_OK;
+}
+
+// parse a call to a variadic builtin
+// the arguments are passed to it in place on the value stack, so
+// there is no limit to their number
+static int
+ParseVarFuncCall(Cvarfunc op, Val *vp)
+{
+    int paramCount;
+    int minargs = tokenArgs;
+    Val *argv;
+    Val t;
+    int i;
+
+    paramCount = ParseCallArgs();
+    if (paramCount < 0) return paramCount;
+    if (paramCount < minargs) {
+        return ArgMismatch();
     }
+#ifdef EXPR_COMPILE
+    if (compiling) {
+        NextToken();
+        return EmitCode(XOP_VARCALL | (paramCount<<8), (Val)op, 1 - paramCount);
+    }
+#endif
+    // the stack grows down, so the arguments are in reverse order
+    argv = valptr;
+    for (i = 0; i < paramCount/2; i++) {
+        t = argv[i];
+        argv[i] = argv[paramCount-1-i];
+        argv[paramCount-1-i] = t;
+    }
+    *vp = op(paramCount, argv);
+    valptr += paramCount;
     NextToken();
     return TS_ERR_OK;
 }
@@ -750,26 +1212,48 @@ ParsePrimary(Val *vp)
     } else if (c == TOK_NUMBER) {
         *vp = StringToNum(token);
         NextToken();
-        return TS_ERR_OK;
+        return EmitConst(*vp);
     } else if (c == TOK_HEX_NUMBER) {
         *vp = HexStringToNum(token);
         NextToken();
-        return TS_ERR_OK;
+        return EmitConst(*vp);
     } else if (c == TOK_CHAR) {
       err = ParseChar(vp, token);
       NextToken();
+      if (err == TS_ERR_OK) err = EmitConst(*vp);
       return err;
+#ifdef EXPR_COMPILE
+    } else if (compiling == COMPILE_EXPR && (c == TOK_VAR || c == TOK_SYMBOL)) {
+        return EmitSlot(token);
+#ifdef ARRAY_SUPPORT
+    } else if (compiling == COMPILE_ARRAY && (c == TOK_BUILTIN || c == VARFUNC || c == USRFUNC)) {
+        // function calls in array assignments are evaluated just once
+        err = ParseOnce(vp);
+        if (err == TS_ERR_OK) err = EmitConst(*vp);
+        return err;
+#endif
+#endif
     } else if (c == TOK_VAR) {
         *vp = tokenVal;
         NextToken();
-        return TS_ERR_OK;
+        return EmitConst(*vp);
+    } else if (c == TOK_STRING && stringHandler) {
+        err = CallStringHandler(token, vp);
+        NextToken();
+        if (err == TS_ERR_OK) err = EmitConst(*vp);
+        return err;
 #ifdef ARRAY_SUPPORT
     } else if (c == TOK_ARY) {
+#ifdef EXPR_COMPILE
+        if (compiling == COMPILE_EXPR) return SyntaxError();
+#endif
         return ParseArrayGet(vp);
 #endif
     } else if (c == TOK_BUILTIN) {
         Cfunc cop = (Cfunc)tokenVal;
         return ParseFuncCall(cop, vp, NULL);
+    } else if (c == VARFUNC) {
+        return ParseVarFuncCall((Cvarfunc)tokenVal, vp);
     } else if (c == USRFUNC) {
         Sym *sym = tokenSym;
         if (!sym) return SyntaxError();
@@ -781,8 +1265,14 @@ ParsePrimary(Val *vp)
         Opfunc op = (Opfunc)tokenVal;
         Val v;
         NextToken();
-        err = ParseExpr(&v);
+        err = EmitConst(0);
+        if (err == TS_ERR_OK) {
+            err = ParseExpr(&v);
+        }
         if (err == TS_ERR_OK) {
+#ifdef EXPR_COMPILE
+            if (compiling) return EmitOp(op);
+#endif
             *vp = op(0, v);
         }
         return err;
@@ -820,6 +1310,13 @@ ParseExprLevel(int max_level, Val *vp)
             if (err != TS_ERR_OK) return err;
             c = curToken;
         }
+#ifdef EXPR_COMPILE
+        if (compiling) {
+            err = EmitOp(op);
+            if (err != TS_ERR_OK) return err;
+            continue;
+        }
+#endif
         lhs = op(lhs, rhs);
     }
     *vp = lhs;
@@ -859,8 +1356,13 @@ DupString(String orig)
     String x;
     char *ptr;
     unsigned len = StringGetLen(orig);
+    unsigned i;
     ptr = stack_alloc(len);
-    if (ptr) {
+    if (ptr && StringIsPaged(orig)) {
+        for (i = 0; i < len; i++) {
+            ptr[i] = SourceChar(orig, (intptr_t)StringGetPtr(orig) + i);
+        }
+    } else if (ptr) {
         memcpy(ptr, StringGetPtr(orig), len);
     }
     StringSetLen(&x, len);
@@ -870,6 +1372,24 @@ DupString(String orig)
 
 static int ParseString(String str, int saveStrings, int topLevel);
 
+// give a string literal its value; one in a paged source is copied to
+// the value stack for the handler while it runs
+static int
+CallStringHandler(String s, Val *vp)
+{
+    Val *saveval = valptr;
+
+    if (StringIsPaged(s)) {
+        s = DupString(s);
+        if (!StringGetPtr(s)) {
+            return OutOfMem();
+        }
+    }
+    *vp = stringHandler(StringGetPtr(s), StringGetLen(s));
+    valptr = saveval;
+    return TS_ERR_OK;
+}
+
 //
 // this is slightly different in that it may return the non-erro TS_ERR_ELSE
 // to signify that the condition was false
@@ -932,7 +1452,7 @@ ParseVarList(UserFunc *uf, int saveStrings)
     for(;;) {
         if (c == TOK_SYMBOL) {
             String name = token;
-            if (saveStrings) {
+            if (saveStrings || InTokenBuf(name)) {
                 name = DupString(name);
             }
             if (nargs >= MAX_BUILTIN_PARAMS) {
@@ -968,6 +1488,10 @@ ParseFuncDef(int saveStrings)
     c = NextRawToken(); // do not interpret the symbol
     if (c != TOK_SYMBOL) return SyntaxError();
     name = token;
+    if (saveStrings || InTokenBuf(name)) {
+        // copy the name into safe memory
+        name = DupString(name);
+    }
     c = NextToken();
     uf = (UserFunc *)stack_alloc(sizeof(*uf));
     if (!uf) return OutOfMem();
@@ -981,8 +1505,7 @@ ParseFuncDef(int saveStrings)
     body = token;
 
     if (saveStrings) {
-        // copy the strings into safe memory
-        name = DupString(name);
+        // copy the body into safe memory
         body = DupString(body);
     }
     uf->body = body;
@@ -993,26 +1516,198 @@ ParseFuncDef(int saveStrings)
 }
 
 #ifdef ARRAY_SUPPORT
-// assign a value or list of values to an array
-static int
-ArrayAssign(Val* ary, Val ix)
+//
+// check whether a pointer refers to a valid array: either one on
+// the value stack, or one which is the value of an array symbol
+// (e.g. an array defined by the application)
+//
+// packed arrays have the element size in bytes in the high bits of
+// the symbol type; 0 means elements are full Vals
+static Sym *
+FindArraySym(Val *ary)
 {
-    int err;
-    Val val;
-    do {
-        if (ix < 0 || ix >= ary[0]) {
-            return OutOfBounds();
-        }
-        NextToken();
-        err = ParseExpr(&val);
-        if (err != TS_ERR_OK) {
-            return err;
+    Sym *s = symptr;
+    while ((intptr_t)s > (intptr_t)arena) {
+        --s;
+        if ((s->type & 0xff) == ARRAY && s->value == (Val)ary) {
+            return s;
         }
-        ary[ix + 1] = val;
-        ix++;
-    } while (curToken == ',');
-    return TS_ERR_OK;
-}
+    }
+    return NULL;
+}
+
+static int
+ArrayOnStack(Val *ary)
+{
+    Val *top = (Val *)(arena + arena_size);
+    return ((intptr_t)ary & (sizeof(Val)-1)) == 0
+        && (intptr_t)ary >= (intptr_t)valptr && (intptr_t)ary < (intptr_t)top
+        && ary[0] >= 0 && ary[0] < top - ary;
+}
+
+//
+// check whether a pointer refers to a valid array of Vals: either one
+// on the value stack, or one which is the value of an array symbol
+// (e.g. an array defined by the application)
+// packed arrays are rejected, since C code expects Val elements
+//
+int
+TinyScript_CheckArray(Val *ary)
+{
+    Sym *s = FindArraySym(ary);
+    if (s) {
+        return ((s->type >> 8) & 0xff) == 0;
+    }
+    return ArrayOnStack(ary);
+}
+
+static Val
+ArrayGetElem(Val *ary, int width, Val ix)
+{
+    switch (width) {
+    case 1: return ((uint8_t *)(ary + 1))[ix];
+    case 2: return ((uint16_t *)(ary + 1))[ix];
+    case 4: return ((int32_t *)(ary + 1))[ix];
+    default: return ary[ix + 1];
+    }
+}
+
+static void
+ArraySetElem(Val *ary, int width, Val ix, Val val)
+{
+    switch (width) {
+    case 1: ((uint8_t *)(ary + 1))[ix] = (uint8_t)val; break;
+    case 2: ((uint16_t *)(ary + 1))[ix] = (uint16_t)val; break;
+    case 4: ((int32_t *)(ary + 1))[ix] = (int32_t)val; break;
+    default: ary[ix + 1] = val; break;
+    }
+}
+
+// assign a value or list of values to an array
+static int
+ArrayAssign(Val* ary, int width, Val ix)
+{
+    int err;
+    Val val;
+    do {
+        if (ix < 0 || ix >= ary[0]) {
+            return OutOfBounds();
+        }
+        NextToken();
+        err = ParseExpr(&val);
+        if (err != TS_ERR_OK) {
+            return err;
+        }
+        ArraySetElem(ary, width, ix, val);
+        ix++;
+    } while (curToken == ',');
+    return TS_ERR_OK;
+}
+
+#ifdef EXPR_COMPILE
+// look ahead to see whether the right hand side of an array
+// assignment is an expression involving whole arrays (arrays
+// without an index), rather than a list of values
+static int
+IsArrayExpr()
+{
+    String savepc = parseptr;
+    String savetoken = token;
+    int savecur = curToken;
+    int saveargs = tokenArgs;
+    Val saveval = tokenVal;
+    Sym *savesym = tokenSym;
+    const struct def *savedef = tokenDef;
+    int depth = 0;
+    int callDepth = -1;     // depth of the call or index we are inside
+    int found = 0;
+    int c;
+
+    c = NextToken();
+    for(;;) {
+        if (c == TOK_ARY || c == TOK_BUILTIN || c == VARFUNC || c == USRFUNC) {
+            // arrays in arguments or indices are evaluated just once,
+            // so only a bare array outside of them makes this an
+            // array expression
+            int ary = (c == TOK_ARY);
+            c = NextToken();
+            if (c == '(') {
+                if (callDepth < 0) callDepth = depth;
+            } else if (ary && callDepth < 0) {
+                found = 1;
+            }
+            continue;
+        }
+        if (c == '(') {
+            depth++;
+        } else if (c == ')') {
+            depth--;
+            if (depth == callDepth) callDepth = -1;
+        } else if (c < 0 || c == '\n' || c == ';' || c == TOK_SYNTAX_ERR || (c == ',' && depth <= 0)) {
+            break;
+        }
+        c = NextToken();
+    }
+    if (c == ',') {
+        found = 0;
+    }
+    parseptr = savepc;
+    token = savetoken;
+    curToken = savecur;
+    tokenArgs = saveargs;
+    tokenVal = saveval;
+    tokenSym = savesym;
+    tokenDef = savedef;
+    return found;
+}
+
+// assign an expression on whole arrays to every element of ary
+// the expression is compiled and then evaluated with the batch
+// kernels; all of the arrays must be at least as long as ary
+static int
+ArrayExprAssign(Val *ary, int width)
+{
+    const Val *columns[MAX_EXPR_SLOTS];
+    CompiledExpr e;
+    Val v;
+    int err;
+    int i;
+
+    if (width) {
+        return ArgMismatch();
+    }
+    codeptr = (Val *)symptr;
+    codeDepth = codeMaxDepth = 0;
+    codeSlots = 0;
+    compiling = COMPILE_ARRAY;
+    NextToken();
+    err = ParseExpr(&v);
+    if (err == TS_ERR_OK) {
+        err = EmitCode(XOP_END, 0, 0);
+    }
+    compiling = 0;
+    if (err != TS_ERR_OK) {
+        return err;
+    }
+    for (i = 0; i < codeSlots; i++) {
+        if (codeArray[i][0] < ary[0]) {
+            if (curToken == '\n' || curToken == ';') {
+                UngetChar();
+            }
+            return OutOfBounds();
+        }
+        columns[i] = codeArray[i] + 1;
+    }
+    e.code = (Val *)symptr;
+    e.ncode = codeptr - e.code;
+    e.nslots = codeSlots;
+    e.depth = codeMaxDepth;
+    return TinyScript_EvalExprBatch(&e, columns, ary[0], ary + 1);
+}
+#else
+#define IsArrayExpr() (0)
+#define ArrayExprAssign(ary, width) (SyntaxError())
+#endif
 
 // handle defining an array
 static int
@@ -1022,6 +1717,8 @@ ParseArrayDef(int saveStrings)
     int c;
     int err;
     Val len;
+    int width = tokenArgs; // element size for packed arrays
+    int size;
 
     c = NextRawToken();
     if (c != TOK_SYMBOL) {
@@ -1032,8 +1729,12 @@ ParseArrayDef(int saveStrings)
 
     if (c == ';' || c == '\n') {
         Sym* sym = LookupSym(name);
+        Sym* orig = sym ? FindArraySym((Val *)sym->value) : NULL;
 		// symbol exists, and its value points to a valid array area
-        if (sym && sym->value > (Val)valptr && sym->value + *((Val*)sym->value - 1) <= (Val)(arena + arena_size)) {
+        if (orig) {
+            sym->type = orig->type;
+            return TS_ERR_OK;
+        } else if (sym && ArrayOnStack((Val *)sym->value)) {
             sym->type = ARRAY;
             return TS_ERR_OK;
         }
@@ -1041,7 +1742,7 @@ ParseArrayDef(int saveStrings)
         return SyntaxError();
     }
 
-    if (saveStrings) {
+    if (saveStrings || InTokenBuf(name)) {
         name = DupString(name);
     }
     if (c != '(') {
@@ -1051,27 +1752,31 @@ ParseArrayDef(int saveStrings)
     if (err != TS_ERR_OK) {
         return err;
     }
-    len++;
-    if ( (intptr_t)symptr >= (intptr_t)(valptr - len)) {        
+    if (len < 0 || len >= (Val)arena_size) {
         return OutOfMem();
     }
-    char *ary = stack_alloc(len * sizeof(Val));
+    size = sizeof(Val) + len * (width ? width : sizeof(Val));
+    char *ary = stack_alloc(size);
     if (!ary) {
         return OutOfMem();
     }
-    memset(ary, 0, len * sizeof(Val));
-    ((Val*)ary)[0] = len - 1;
-    tokenSym = DefineSym(name, ARRAY, (Val)ary);
+    memset(ary, 0, size);
+    ((Val*)ary)[0] = len;
+    tokenSym = DefineSym(name, ARRAY | (width<<8), (Val)ary);
     if (!tokenSym) {
         return OutOfMem();
     }
-    if (StringGetPtr(token)[0] == '=' && StringGetLen(token) == 1) {
-        return ArrayAssign((Val*)ary, 0);
+    if (IsAssignToken()) {
+        if (IsArrayExpr()) {
+            return ArrayExprAssign((Val*)ary, width);
+        }
+        return ArrayAssign((Val*)ary, width, 0);
     } else {
         return TS_ERR_OK;
     }
 }
 
+
 // handle setting an array value
 static int 
 ParseArraySet()
@@ -1079,6 +1784,7 @@ ParseArraySet()
     int err;
     Val ix = 0;
     Val* ary = (Val*)tokenVal;
+    int width = tokenArgs;
     int c = NextToken();
     if (c == '(')
     {
@@ -1087,32 +1793,93 @@ ParseArraySet()
             return err;
         }
     }   
-    if (StringGetPtr(token)[0] != '=' || StringGetLen(token) != 1) {
+    if (!IsAssignToken()) {
         return SyntaxError();
     }
-    return ArrayAssign(ary, ix);
+    if (c != '(' && IsArrayExpr()) {
+        return ArrayExprAssign(ary, width);
+    }
+    return ArrayAssign(ary, width, ix);
+}
+
+#ifdef EXPR_COMPILE
+// evaluate part of a compiled expression (a function call or an index)
+// once, while the expression is being compiled; this may run a script
+// function, which defines symbols where the code is being compiled
+// (and may even make array assignments of its own), so the code
+// compiled so far is kept on the value stack until it is done
+static int
+ParseOnce(Val *vp)
+{
+    Val *codebase = (Val *)symptr;
+    int n = (codeptr - codebase) * sizeof(Val);
+    Val *savearrays[MAX_EXPR_SLOTS];
+    int saveslots = codeSlots;
+    int savedepth = codeDepth;
+    int savemax = codeMaxDepth;
+    int save = compiling;
+    char *copy;
+    int err;
+
+    copy = stack_alloc(n);
+    if (!copy) {
+        return OutOfMem();
+    }
+    memcpy(copy, codebase, n);
+    memcpy(savearrays, codeArray, sizeof(codeArray));
+    compiling = 0;
+    err = ParsePrimary(vp);
+    compiling = save;
+    memcpy(codebase, copy, n);
+    codeptr = codebase + n / sizeof(Val);
+    codeSlots = saveslots;
+    codeDepth = savedepth;
+    codeMaxDepth = savemax;
+    memcpy(codeArray, savearrays, sizeof(codeArray));
+    // the copy can go unless the function left something below it
+    if ((char *)valptr == copy) {
+        valptr = (Val *)(copy + n);
+    }
+    return err;
 }
+#endif
 
 // handle getting an array value
 static int
 ParseArrayGet(Val *vp)
 {
     Val* ary = (Val*)tokenVal;
+    int width = tokenArgs;
     int c = NextToken();
     if (c == '(') {     
         Val ix;
-        int err = ParsePrimary(&ix);
+        int err;
+#ifdef EXPR_COMPILE
+        // in an array assignment the index is evaluated just once
+        if (compiling) {
+            err = ParseOnce(&ix);
+        } else
+#endif
+        err = ParsePrimary(&ix);
         if (err != TS_ERR_OK) {     
             return err;
         }
         if (ix < -1 || ix >= ary[0]) {
             return OutOfBounds();
         }
-        *vp = ary[ix + 1];
+        *vp = (ix < 0) ? ary[0] : ArrayGetElem(ary, width, ix);
+        return EmitConst(*vp);
     } else {
         // if no parens, then return the pointer to the array
         // needed for passing to C functions
         *vp = (Val)ary;
+#ifdef EXPR_COMPILE
+        if (compiling == COMPILE_ARRAY) {
+            // packed arrays cannot be used in whole array expressions
+            if (width) return ArgMismatch();
+            return EmitArray(ary);
+        }
+#endif
     }
     return TS_ERR_OK;
 }
@@ -1197,7 +1964,9 @@ ParseStmt(int saveStrings)
         do {
             c = GetChar();
         } while (c >= 0 && c != '\n' && c != ';' && c != '}');
-        UngetChar();
+        if (c >= 0) {
+            UngetChar();
+        }
         NextToken();
         return TS_ERR_OK;
     }
@@ -1208,7 +1977,7 @@ ParseStmt(int saveStrings)
         // a definition var a=x
         c=NextRawToken(); // we want to get VAR_SYMBOL directly
         if (c != TOK_SYMBOL) return SyntaxError();
-        if (saveStrings) {
+        if (saveStrings || InTokenBuf(token)) {
             name = DupString(token);
         } else {
             name = token;
@@ -1228,7 +1997,7 @@ ParseStmt(int saveStrings)
         c = NextToken();
         // we expect the "=" operator
         // verify that it is "="
-        if (StringGetPtr(token)[0] != '=' || StringGetLen(token) != 1) {
+        if (!IsAssignToken()) {
             return SyntaxError();
         }
         if (!s) {
@@ -1237,6 +2006,9 @@ ParseStmt(int saveStrings)
 #endif
             return UnknownSymbol(); // unknown symbol
         }
+        if (IsBuiltinSym(s)) {
+            return ReadOnly();
+        }
         NextToken();
         err = ParseExpr(&val);
         if (err != TS_ERR_OK) {
@@ -1247,10 +2019,10 @@ ParseStmt(int saveStrings)
     } else if (c == TOK_ARY) {
         err = ParseArraySet();
 #endif
-    } else if (c == TOK_BUILTIN || c == USRFUNC) {
+    } else if (c == TOK_BUILTIN || c == VARFUNC || c == USRFUNC) {
         err = ParsePrimary(&val);
         return err;
-    } else if (tokenSym && tokenVal) {
+    } else if (tokenDef && tokenVal) {
         int (*func)(int) = (void *)tokenVal;
         err = (*func)(saveStrings);
     } else {
@@ -1314,68 +2086,1248 @@ static Val le(Val x, Val y) { return x<=y; }
 static Val gt(Val x, Val y) { return x>y; }
 static Val ge(Val x, Val y) { return x>=y; }
 
-static struct def {
-    const char *name;
-    int toktype;
-    intptr_t val;
-} defs[] = {
+#ifdef EXPR_COMPILE
+//
+// kernels for evaluating the stock operators over a block of rows
+// these are simple loops over contiguous values which the C compiler
+// can turn into vector instructions
+//
+typedef void (*Kernel)(Val *r, const Val *x, const Val *y, int n);
+
+#define KERNEL(name, op) \
+    static void name##_n(Val *r, const Val *x, const Val *y, int n) \
+    { int i; for (i = 0; i < n; i++) r[i] = x[i] op y[i]; }
+
+KERNEL(prod, *)
+KERNEL(quot, /)
+KERNEL(mod, %)
+KERNEL(sum, +)
+KERNEL(diff, -)
+KERNEL(bitand, &)
+KERNEL(bitor, |)
+KERNEL(bitxor, ^)
+KERNEL(shl, <<)
+KERNEL(shr, >>)
+KERNEL(equals, ==)
+KERNEL(ne, !=)
+KERNEL(lt, <)
+KERNEL(le, <=)
+KERNEL(gt, >)
+KERNEL(ge, >=)
+
+static const struct kernel {
+    Opfunc op;
+    Kernel kernel;
+} kernels[] = {
+    { NULL, NULL },  // 0 means no kernel
+    { prod, prod_n },
+    { quot, quot_n },
+    { mod, mod_n },
+    { sum, sum_n },
+    { diff, diff_n },
+    { bitand, bitand_n },
+    { bitor, bitor_n },
+    { bitxor, bitxor_n },
+    { shl, shl_n },
+    { shr, shr_n },
+    { equals, equals_n },
+    { ne, ne_n },
+    { lt, lt_n },
+    { le, le_n },
+    { gt, gt_n },
+    { ge, ge_n },
+};
+
+// find the batch kernel for an operator, or 0 if there is none
+static int
+OpKernel(Opfunc op)
+{
+    int i;
+    for (i = 1; i < sizeof(kernels)/sizeof(kernels[0]); i++) {
+        if (kernels[i].op == op) return i;
+    }
+    return 0;
+}
+#endif
+
+// the stock keywords and operators are kept in a constant table
+// (which may live in ROM) rather than in the arena, so they need no
+// space there and no setting up; the lexer looks in it before looking
+// at the symbols in the arena. The table is indexed by a perfect hash
+// of the spelling, i.e. no two entries have the same hash; if entries
+// are added, the constants in KeywordHash may need to be changed to
+// keep it perfect.
+#define KEYWORD_SLOTS 48
+
+static const struct def defs[KEYWORD_SLOTS] = {
     // keywords
-    { "if",    TOK_IF, (intptr_t)ParseIf },
-    { "else",  TOK_ELSE, 0 },
-    { "elseif",TOK_ELSEIF, 0 },
-    { "while", TOK_WHILE, (intptr_t)ParseWhile },
-    { "print", TOK_PRINT, (intptr_t)ParsePrint },
-    { "var",   TOK_VARDEF, 0 },
-    { "func",  TOK_FUNCDEF, (intptr_t)ParseFuncDef },
-    { "return", TOK_RETURN, (intptr_t)ParseReturn },
+    [20] = { "if",    TOK_IF, (intptr_t)ParseIf },
+    [37] = { "else",  TOK_ELSE, 0 },
+    [32] = { "elseif",TOK_ELSEIF, 0 },
+    [14] = { "while", TOK_WHILE, (intptr_t)ParseWhile },
+    [43] = { "print", TOK_PRINT, (intptr_t)ParsePrint },
+    [3]  = { "var",   TOK_VARDEF, 0 },
+    [15] = { "func",  TOK_FUNCDEF, (intptr_t)ParseFuncDef },
+    [4]  = { "return", TOK_RETURN, (intptr_t)ParseReturn },
 #ifdef ARRAY_SUPPORT
-    { "array", TOK_ARYDEF, (intptr_t)ParseArrayDef },
+    [10] = { "array", TOK_ARYDEF, (intptr_t)ParseArrayDef },
+    [30] = { "array8", TOK_ARYDEF | (1<<8), (intptr_t)ParseArrayDef },
+    [39] = { "array16", TOK_ARYDEF | (2<<8), (intptr_t)ParseArrayDef },
+    [35] = { "array32", TOK_ARYDEF | (4<<8), (intptr_t)ParseArrayDef },
 #endif
     // operators
-    { "*",     BINOP(1), (intptr_t)prod },
-    { "/",     BINOP(1), (intptr_t)quot },
-    { "%",     BINOP(1), (intptr_t)mod },
-    { "+",     BINOP(2), (intptr_t)sum },
-    { "-",     BINOP(2), (intptr_t)diff },
-    { "!",     BINOP(2), (intptr_t)equals },
-    { "&",     BINOP(3), (intptr_t)bitand },
-    { "|",     BINOP(3), (intptr_t)bitor },
-    { "^",     BINOP(3), (intptr_t)bitxor },
-    { ">>",    BINOP(3), (intptr_t)shr },
-    { "<<",    BINOP(3), (intptr_t)shl },
-    { "=",     BINOP(4), (intptr_t)equals },
-    { "<>",    BINOP(4), (intptr_t)ne },
-    { "<",     BINOP(4), (intptr_t)lt },
-    { "<=",    BINOP(4), (intptr_t)le },
-    { ">",     BINOP(4), (intptr_t)gt },
-    { ">=",    BINOP(4), (intptr_t)ge },
-
-    { NULL, 0, 0 }
+    [1]  = { "*",     BINOP(1), (intptr_t)prod },
+    [40] = { "/",     BINOP(1), (intptr_t)quot },
+    [42] = { "%",     BINOP(1), (intptr_t)mod },
+    [44] = { "+",     BINOP(2), (intptr_t)sum },
+    [2]  = { "-",     BINOP(2), (intptr_t)diff },
+    [46] = { "!",     BINOP(2), (intptr_t)equals },
+    [29] = { "&",     BINOP(3), (intptr_t)bitand },
+    [47] = { "|",     BINOP(3), (intptr_t)bitor },
+    [5]  = { "^",     BINOP(3), (intptr_t)bitxor },
+    [16] = { ">>",    BINOP(3), (intptr_t)shr },
+    [26] = { "<<",    BINOP(3), (intptr_t)shl },
+    [34] = { "=",     BINOP(4), (intptr_t)equals },
+    [24] = { "<>",    BINOP(4), (intptr_t)ne },
+    [31] = { "<",     BINOP(4), (intptr_t)lt },
+    [19] = { "<=",    BINOP(4), (intptr_t)le },
+    [21] = { ">",     BINOP(4), (intptr_t)gt },
+    [27] = { ">=",    BINOP(4), (intptr_t)ge },
 };
 
+static unsigned
+KeywordHash(const Byte *ptr, unsigned len)
+{
+    return ((ptr[0]*4) ^ (ptr[len-1]*169) ^ (len*19)) % KEYWORD_SLOTS;
+}
+
+// look up a stock keyword or operator
+static const struct def *
+LookupKeyword(String name)
+{
+    const Byte *ptr = (const Byte *)StringGetPtr(name);
+    unsigned len = StringGetLen(name);
+    const struct def *d;
+
+    if (len == 0) {
+        return NULL;
+    }
+    d = &defs[KeywordHash(ptr, len)];
+    if (d->name && !strncmp(d->name, (const char *)ptr, len) && d->name[len] == 0) {
+        return d;
+    }
+    return NULL;
+}
+
 int
 TinyScript_Init(void *mem, int mem_size)
 {
-    int i;
-    int err;
-    
     arena = (Byte *)mem;
     arena_size = mem_size;
     symptr = (Sym *)arena;
     valptr = (Val *)(arena + arena_size);
-    for (i = 0; defs[i].name; i++) {
-        err = TinyScript_Define(defs[i].name, defs[i].toktype, defs[i].val);
-        if (err != TS_ERR_OK)
-            return err;
-    }
     return TS_ERR_OK;
 }
 
 int
 TinyScript_Run(const char *buf, int saveStrings, int topLevel)
 {
+    return TinyScript_RunBuffer(buf, strlen(buf), saveStrings, topLevel);
+}
+
+//
+// run a script of len bytes, which need not end with a 0 (so that it
+// may be run straight from a file mapped into memory, for example)
+//
+int
+TinyScript_RunBuffer(const char *buf, unsigned len, int saveStrings, int topLevel)
+{
+    String s;
+
 #ifdef VERBOSE_ERRORS
     script_buffer = buf;
 #endif
-    return ParseString(Cstring(buf), saveStrings, topLevel);
+    StringSetPtr(&s, buf);
+    StringSetLen(&s, len);
+    return ParseString(s, saveStrings, topLevel);
+}
+
+#ifdef PAGED_SOURCE
+//
+// set the source which TinyScript_RunSource reads; there is one source
+// at a time, and functions defined by a script in it read their bodies
+// from it when they are called
+//
+void
+TinyScript_SetSource(Pagefunc read, void *arg)
+{
+    int i;
+
+    pageRead = read;
+    pageArg = arg;
+    for (i = 0; i < SOURCE_PAGES; i++) {
+        pageNum[i] = 0;
+    }
+}
+
+//
+// run the script of len bytes in the source, reading it a page at a
+// time; names are copied to the arena as they are defined, but
+// function bodies and loops are read again from the source
+//
+int
+TinyScript_RunSource(unsigned long len, int topLevel)
+{
+    String s;
+
+    if (len >= STRING_PAGED) {
+        return TS_ERR_NOMEM;
+    }
+    StringSetPtr(&s, NULL);
+    StringSetLen(&s, len);
+    StringSetPaged(&s, 1);
+    return ParseString(s, 0, topLevel);
+}
+#endif
+
+//
+// set the function which converts string literals used as values
+// (for example as function arguments) into values; without one they
+// are syntax errors
+//
+void
+TinyScript_SetStringHandler(Strfunc fn)
+{
+    stringHandler = fn;
+}
+
+//
+// build a table of builtins which can be shared by all contexts
+// TinyScript_Define calls between TinyScript_BeginBuiltins and
+// TinyScript_EndBuiltins put the symbols into "mem" instead of the
+// arena; EndBuiltins then adds a hash index and returns the table,
+// which is not changed again and may be given to any number of
+// contexts with TinyScript_UseBuiltins
+//
+static BuiltinTable *building;
+static Byte *savedArena;
+static int savedArenaSize;
+static Sym *savedSymptr;
+static Val *savedValptr;
+
+int
+TinyScript_BeginBuiltins(void *mem, int mem_size)
+{
+    int header = (sizeof(BuiltinTable) + sizeof(Val) - 1) & ~(sizeof(Val) - 1);
+
+    if (building || mem_size <= header) {
+        return TS_ERR_NOMEM;
+    }
+    building = (BuiltinTable *)mem;
+    savedArena = arena;
+    savedArenaSize = arena_size;
+    savedSymptr = symptr;
+    savedValptr = valptr;
+    arena = (Byte *)mem + header;
+    arena_size = mem_size - header;
+    symptr = (Sym *)arena;
+    valptr = (Val *)(arena + arena_size);
+    return TS_ERR_OK;
+}
+
+const BuiltinTable *
+TinyScript_EndBuiltins(void)
+{
+    BuiltinTable *table = building;
+    int n;
+    unsigned slots = 4;
+    unsigned h;
+    int i;
+
+    if (!table) {
+        return NULL;
+    }
+    n = symptr - (Sym *)arena;
+    while (slots < 2*n) {
+        slots *= 2;
+    }
+    table->nsyms = n;
+    table->mask = slots - 1;
+    table->syms = (Sym *)arena;
+    table->index = (int *)symptr;
+    if ((intptr_t)(table->index + slots) > (intptr_t)valptr) {
+        table = NULL;
+    } else {
+        for (h = 0; h < slots; h++) {
+            table->index[h] = -1;
+        }
+        // later definitions take precedence, as they do in the arena
+        for (i = n-1; i >= 0; i--) {
+            h = HashString(table->syms[i].name) & table->mask;
+            while (table->index[h] >= 0) {
+                h = (h + 1) & table->mask;
+            }
+            table->index[h] = i;
+        }
+    }
+    building = NULL;
+    arena = savedArena;
+    arena_size = savedArenaSize;
+    symptr = savedSymptr;
+    valptr = savedValptr;
+    return table;
+}
+
+void
+TinyScript_UseBuiltins(const BuiltinTable *table)
+{
+    builtins = table;
+}
+
+//
+// switch between contexts; the arenas stay where they are, so this
+// costs nothing more than saving a few pointers
+//
+void
+TinyScript_SaveContext(ContextState *state)
+{
+    state->arena = arena;
+    state->arena_size = arena_size;
+    state->symptr = symptr;
+    state->valptr = valptr;
+}
+
+void
+TinyScript_SwitchContext(const ContextState *state)
+{
+    arena = state->arena;
+    arena_size = state->arena_size;
+    symptr = state->symptr;
+    valptr = state->valptr;
+}
+
+//
+// snapshots: a copy of the symbols and value stack of the current
+// context, from which any number of new contexts may be started
+// the symbols are copied to the bottom of the new arena and the value
+// stack to the top, so pointers into each part move by a different
+// amount; the pointers in symbol names, user functions and arrays are
+// adjusted, while ones outside the arena (such as names in script text
+// which was not saved) are left alone
+//
+struct snapshot {
+    Byte *base;       // arena the snapshot was taken from
+    int arena_size;
+    int symbytes;     // size of the symbols
+    int valbytes;     // size of the value stack
+};
+
+#define SNAPSHOT_HEADER ((sizeof(struct snapshot) + sizeof(Val) - 1) & ~(sizeof(Val) - 1))
+
+//
+// save the current context in buf; returns the number of bytes used,
+// or TS_ERR_NOMEM if buf is too small (pass a NULL buf to find out
+// how big it has to be)
+//
+int
+TinyScript_Snapshot(void *buf, int size)
+{
+    struct snapshot *snap = (struct snapshot *)buf;
+    Byte *top = arena + arena_size;
+    int symbytes = (Byte *)symptr - arena;
+    int valbytes = top - (Byte *)valptr;
+    int needed = SNAPSHOT_HEADER + symbytes + valbytes;
+
+    if (!buf) {
+        return needed;
+    }
+    if (size < needed) {
+        return TS_ERR_NOMEM;
+    }
+    snap->base = arena;
+    snap->arena_size = arena_size;
+    snap->symbytes = symbytes;
+    snap->valbytes = valbytes;
+    memcpy((Byte *)buf + SNAPSHOT_HEADER, arena, symbytes);
+    memcpy((Byte *)buf + SNAPSHOT_HEADER + symbytes, valptr, valbytes);
+    return needed;
+}
+
+// where a pointer from the snapshot's arena is in the new one
+static Val
+Relocate(const struct snapshot *snap, Val p)
+{
+    Byte *oldtop = snap->base + snap->arena_size;
+
+    if (p >= (Val)snap->base && p < (Val)(snap->base + snap->symbytes)) {
+        return p + ((Val)arena - (Val)snap->base);
+    }
+    if (p >= (Val)(oldtop - snap->valbytes) && p < (Val)oldtop) {
+        return p + ((Val)(arena + arena_size) - (Val)oldtop);
+    }
+    return p;
+}
+
+static void
+RelocateString(const struct snapshot *snap, String *s)
+{
+    // offsets in a paged source stay as they are
+    if (!StringIsPaged(*s)) {
+        StringSetPtr(s, (const char *)Relocate(snap, (Val)StringGetPtr(*s)));
+    }
+}
+
+//
+// start a new context in mem from a snapshot; this replaces
+// TinyScript_Init, and the new arena need not be the same size as
+// the original one
+// compiled expressions are not carried over, and integer variables
+// keep their values as they are even if they hold addresses
+//
+int
+TinyScript_Clone(const void *buf, void *mem, int mem_size)
+{
+    const struct snapshot *snap = (const struct snapshot *)buf;
+    const Byte *data = (const Byte *)buf + SNAPSHOT_HEADER;
+    Sym *s;
+    UserFunc *uf;
+    int i;
+
+    if (snap->symbytes + snap->valbytes > mem_size) {
+        return TS_ERR_NOMEM;
+    }
+    TinyScript_Init(mem, mem_size);
+    symptr = (Sym *)(arena + snap->symbytes);
+    valptr = (Val *)(arena + arena_size - snap->valbytes);
+    memcpy(arena, data, snap->symbytes);
+    memcpy(valptr, data + snap->symbytes, snap->valbytes);
+
+    for (s = (Sym *)arena; s < symptr; s++) {
+        RelocateString(snap, &s->name);
+        switch (s->type & 0xff) {
+        case USRFUNC:
+            s->value = Relocate(snap, s->value);
+            uf = (UserFunc *)s->value;
+            RelocateString(snap, &uf->body);
+            for (i = 0; i < uf->nargs; i++) {
+                RelocateString(snap, &uf->argName[i]);
+            }
+            break;
+#ifdef ARRAY_SUPPORT
+        case ARRAY:
+            s->value = Relocate(snap, s->value);
+            break;
+#endif
+        default:
+            break;
+        }
+    }
+    return TS_ERR_OK;
 }
+
+#ifdef IMAGE_SUPPORT
+//
+// script images: the variables, arrays and functions defined by a
+// script, written out with offsets instead of pointers so that the
+// image can be saved to a file and loaded at any address
+// loading an image defines its symbols without parsing anything;
+// names and function bodies are used in place, so only the symbols,
+// function descriptions and arrays take space in the arena, and the
+// image may be in read-only memory shared by many contexts
+//
+#define IMAGE_MAGIC "TSI"
+#define IMAGE_VERSION 1
+
+struct image_header {
+    char magic[3];
+    uint8_t valsize;    // sizeof(Val) of the writer
+    uint32_t version;
+    uint32_t size;      // total bytes
+    uint32_t nsyms;
+};
+
+struct image_sym {
+    uint32_t name;      // offset of name
+    uint32_t namelen;
+    int32_t type;
+    uint32_t reserved;
+    Val value;          // INT: the value; otherwise offset of the data
+};
+
+struct image_func {
+    uint32_t body;
+    uint32_t bodylen;
+    uint32_t nargs;
+    uint32_t argName[MAX_BUILTIN_PARAMS];
+    uint32_t argLen[MAX_BUILTIN_PARAMS];
+};
+
+#define ImageAlign(n) (((n) + sizeof(Val) - 1) & ~(sizeof(Val) - 1))
+
+// whether a symbol can be put in an image: builtins and operators
+// point to C code, and arrays defined by the application are its own
+static int
+ImageSym(Sym *s)
+{
+    int typ = s->type & 0xff;
+
+    if (typ == INT || typ == USRFUNC) {
+        return 1;
+    }
+#ifdef ARRAY_SUPPORT
+    if (typ == ARRAY) {
+        return s->value >= (Val)valptr && s->value < (Val)(arena + arena_size);
+    }
+#endif
+    return 0;
+}
+
+// the part of an image which is being written: the bytes at offsets
+// from lo up to hi go into buf (so that a big image can be written a
+// piece at a time)
+struct image_window {
+    Byte *buf;
+    uint32_t lo;
+    uint32_t hi;
+};
+
+// copy n bytes to offset "at" of the image, if that is in the window
+static uint32_t
+ImagePut(const struct image_window *w, uint32_t at, const void *data, uint32_t n)
+{
+    uint32_t from, to;
+
+    if (w) {
+        from = at > w->lo ? at : w->lo;
+        to = at + n < w->hi ? at + n : w->hi;
+        if (from < to) {
+            memcpy(w->buf + (from - w->lo), (const Byte *)data + (from - at), to - from);
+        }
+    }
+    return at + n;
+}
+
+// copy a string to offset "at" of the image; one in a paged source is
+// read a piece at a time
+static uint32_t
+ImagePutString(const struct image_window *w, uint32_t at, String s)
+{
+    Byte piece[32];
+    intptr_t from = (intptr_t)StringGetPtr(s);
+    uint32_t len = StringGetLen(s);
+    uint32_t i, n;
+
+    if (!StringIsPaged(s)) {
+        return ImagePut(w, at, StringGetPtr(s), len);
+    }
+    while (len > 0) {
+        n = len < sizeof(piece) ? len : sizeof(piece);
+        // only the part in the window needs to be read
+        if (w && at < w->hi && at + n > w->lo) {
+            for (i = 0; i < n; i++) {
+                piece[i] = SourceChar(s, from + i);
+            }
+        }
+        at = ImagePut(w, at, piece, n);
+        from += n;
+        len -= n;
+    }
+    return at;
+}
+
+// lay out the image in a window, or just find its size if buf is NULL
+static uint32_t
+ImageLayout(const struct image_window *buf)
+{
+    struct image_header hdr;
+    struct image_sym isym;
+    struct image_func ifunc;
+    UserFunc *uf;
+    Sym *s;
+    uint32_t at;
+    uint32_t nsyms = 0;
+    int i;
+
+    if (buf) {
+        // the padding between items is zero
+        memset(buf->buf, 0, buf->hi - buf->lo);
+    }
+    for (s = (Sym *)arena; s < symptr; s++) {
+        nsyms += ImageSym(s);
+    }
+    // the symbols come first, then their names and data
+    at = ImageAlign(sizeof(hdr) + nsyms * sizeof(isym));
+    nsyms = 0;
+    for (s = (Sym *)arena; s < symptr; s++) {
+        if (!ImageSym(s)) {
+            continue;
+        }
+        memset(&isym, 0, sizeof(isym));
+        isym.type = s->type;
+        isym.namelen = StringGetLen(s->name);
+        isym.name = at;
+        at = ImagePutString(buf, at, s->name);
+        at = ImageAlign(at);
+        switch (s->type & 0xff) {
+        case INT:
+            isym.value = s->value;
+            break;
+        case USRFUNC:
+            uf = (UserFunc *)s->value;
+            memset(&ifunc, 0, sizeof(ifunc));
+            ifunc.nargs = uf->nargs;
+            isym.value = at;
+            at += sizeof(ifunc);
+            ifunc.bodylen = StringGetLen(uf->body);
+            ifunc.body = at;
+            at = ImagePutString(buf, at, uf->body);
+            for (i = 0; i < uf->nargs; i++) {
+                ifunc.argLen[i] = StringGetLen(uf->argName[i]);
+                ifunc.argName[i] = at;
+                at = ImagePutString(buf, at, uf->argName[i]);
+            }
+            ImagePut(buf, isym.value, &ifunc, sizeof(ifunc));
+            at = ImageAlign(at);
+            break;
+#ifdef ARRAY_SUPPORT
+        default: {
+            Val *ary = (Val *)s->value;
+            int width = (s->type >> 8) & 0xff;
+            isym.value = at;
+            at = ImagePut(buf, at, ary, sizeof(Val) + ary[0] * (width ? width : sizeof(Val)));
+            at = ImageAlign(at);
+            break;
+        }
+#endif
+        }
+        ImagePut(buf, sizeof(hdr) + nsyms * sizeof(isym), &isym, sizeof(isym));
+        nsyms++;
+    }
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, IMAGE_MAGIC, sizeof(hdr.magic));
+    hdr.valsize = sizeof(Val);
+    hdr.version = IMAGE_VERSION;
+    hdr.size = at;
+    hdr.nsyms = nsyms;
+    ImagePut(buf, 0, &hdr, sizeof(hdr));
+    return at;
+}
+
+//
+// write the script symbols of the current context as an image in buf
+// returns the number of bytes used, or TS_ERR_NOMEM if buf is too
+// small (pass a NULL buf to find out how big it has to be)
+//
+int
+TinyScript_WriteImage(void *buf, int size)
+{
+    struct image_window w;
+    int needed = ImageLayout(NULL);
+
+    if (!buf) {
+        return needed;
+    }
+    if (size < needed) {
+        return TS_ERR_NOMEM;
+    }
+    w.buf = (Byte *)buf;
+    w.lo = 0;
+    w.hi = needed;
+    ImageLayout(&w);
+    return needed;
+}
+
+// a string in an image, or one with a NULL pointer if it is not
+// inside the image
+static String
+ImageString(const Byte *image, uint32_t size, uint32_t at, uint32_t len)
+{
+    String s;
+
+    StringSetLen(&s, len);
+    StringSetPtr(&s, (at <= size && len <= size - at) ? image + at : NULL);
+    return s;
+}
+
+//
+// define the symbols of an image in the current context
+// if "inplace" is set the image is in the arena, and its arrays are
+// used where they are; otherwise they are copied
+//
+static int
+LoadImage(const Byte *base, int size, int inplace)
+{
+    const struct image_header *hdr = (const struct image_header *)base;
+    const struct image_sym *isym = (const struct image_sym *)(hdr + 1);
+    const struct image_func *ifunc;
+    Sym *savesym = symptr;
+    Val *saveval = valptr;
+    UserFunc *uf;
+    String name;
+    Val value;
+    uint32_t i;
+    int j;
+
+    if (size < (int)sizeof(*hdr) || memcmp(hdr->magic, IMAGE_MAGIC, sizeof(hdr->magic)) != 0
+        || hdr->valsize != sizeof(Val) || hdr->version != IMAGE_VERSION
+        || hdr->size < sizeof(*hdr) || hdr->size > (uint32_t)size || hdr->nsyms > (hdr->size - sizeof(*hdr)) / sizeof(*isym)) {
+        return TS_ERR_BADIMAGE;
+    }
+    size = hdr->size;
+    for (i = 0; i < hdr->nsyms; i++, isym++) {
+        name = ImageString(base, size, isym->name, isym->namelen);
+        value = isym->value;
+        switch (isym->type & 0xff) {
+        case INT:
+            break;
+        case USRFUNC:
+            if (value < 0 || value > size - (Val)sizeof(*ifunc) || (value & (sizeof(Val)-1))) {
+                goto bad;
+            }
+            ifunc = (const struct image_func *)(base + value);
+            uf = (UserFunc *)stack_alloc(sizeof(*uf));
+            if (!uf) {
+                goto nomem;
+            }
+            uf->nargs = ifunc->nargs;
+            uf->body = ImageString(base, size, ifunc->body, ifunc->bodylen);
+            if (uf->nargs > MAX_BUILTIN_PARAMS || !StringGetPtr(uf->body)) {
+                goto bad;
+            }
+            for (j = 0; j < uf->nargs; j++) {
+                uf->argName[j] = ImageString(base, size, ifunc->argName[j], ifunc->argLen[j]);
+                if (!StringGetPtr(uf->argName[j])) {
+                    goto bad;
+                }
+            }
+            value = (Val)uf;
+            break;
+#ifdef ARRAY_SUPPORT
+        case ARRAY: {
+            const Val *ary;
+            int width = (isym->type >> 8) & 0xff;
+            Val bytes;
+            Byte *copy;
+            if (value < 0 || value > size - (Val)sizeof(Val) || (value & (sizeof(Val)-1))) {
+                goto bad;
+            }
+            ary = (const Val *)(base + value);
+            bytes = ary[0] * (width ? width : sizeof(Val));
+            if (ary[0] < 0 || ary[0] > size || bytes > size - value - (Val)sizeof(Val)) {
+                goto bad;
+            }
+            if (inplace) {
+                value = (Val)ary;
+                break;
+            }
+            copy = stack_alloc(sizeof(Val) + bytes);
+            if (!copy) {
+                goto nomem;
+            }
+            memcpy(copy, ary, sizeof(Val) + bytes);
+            value = (Val)copy;
+            break;
+        }
+#endif
+        default:
+            goto bad;
+        }
+        if (!StringGetPtr(name)) {
+            goto bad;
+        }
+        if (!DefineSym(name, isym->type, value)) {
+            goto nomem;
+        }
+    }
+    return TS_ERR_OK;
+bad:
+    symptr = savesym;
+    valptr = saveval;
+    return TS_ERR_BADIMAGE;
+nomem:
+    symptr = savesym;
+    valptr = saveval;
+    return OutOfMem();
+}
+
+//
+// define the symbols of an image in the current context
+// the image must be aligned for a Val, and must stay where it is (and
+// unchanged) while the context uses it; arrays are copied into the
+// arena, since scripts may change them
+//
+int
+TinyScript_LoadImage(const void *image, int size)
+{
+    return LoadImage((const Byte *)image, size, 0);
+}
+
+#ifdef CHECKPOINT_SUPPORT
+//
+// checkpoints: the image of a context written to a file, from which
+// the context can be restored after the program restarts
+//
+#define CHECKPOINT_CHUNK 256
+
+static int
+WriteAll(int fd, const Byte *ptr, uint32_t n)
+{
+    ssize_t r;
+
+    while (n > 0) {
+        r = write(fd, ptr, n);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r <= 0) {
+            return TS_ERR_IO;
+        }
+        ptr += r;
+        n -= r;
+    }
+    return TS_ERR_OK;
+}
+
+static int
+ReadAll(int fd, Byte *ptr, uint32_t n)
+{
+    ssize_t r;
+
+    while (n > 0) {
+        r = read(fd, ptr, n);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r <= 0) {
+            return TS_ERR_IO;
+        }
+        ptr += r;
+        n -= r;
+    }
+    return TS_ERR_OK;
+}
+
+//
+// write the image of the current context to a file
+// the image is built a piece at a time in the free part of the arena
+// (or in a small buffer if there is not much free), so that no extra
+// memory is needed
+//
+int
+TinyScript_Checkpoint(int fd)
+{
+    Byte chunk[CHECKPOINT_CHUNK];
+    struct image_window w;
+    uint32_t size = ImageLayout(NULL);
+    uint32_t n = (Byte *)valptr - (Byte *)symptr;
+    int err;
+
+    if (n > sizeof(chunk)) {
+        w.buf = (Byte *)symptr;
+    } else {
+        w.buf = chunk;
+        n = sizeof(chunk);
+    }
+    for (w.lo = 0; w.lo < size; w.lo = w.hi) {
+        w.hi = (size - w.lo > n) ? w.lo + n : size;
+        ImageLayout(&w);
+        err = WriteAll(fd, w.buf, w.hi - w.lo);
+        if (err != TS_ERR_OK) {
+            return err;
+        }
+    }
+    return TS_ERR_OK;
+}
+
+//
+// restore the symbols saved by TinyScript_Checkpoint into the current
+// context (normally one just set up with TinyScript_Init)
+// the image is read onto the value stack and used there, so names,
+// function bodies and arrays are not copied again
+//
+int
+TinyScript_Restore(int fd)
+{
+    struct image_header hdr;
+    Val *saveval = valptr;
+    Byte *image;
+    int err;
+
+    err = ReadAll(fd, (Byte *)&hdr, sizeof(hdr));
+    if (err != TS_ERR_OK) {
+        return err;
+    }
+    if (hdr.size < sizeof(hdr) || hdr.size > (uint32_t)arena_size) {
+        return TS_ERR_BADIMAGE;
+    }
+    image = stack_alloc(hdr.size);
+    if (!image) {
+        return OutOfMem();
+    }
+    memcpy(image, &hdr, sizeof(hdr));
+    err = ReadAll(fd, image + sizeof(hdr), hdr.size - sizeof(hdr));
+    if (err == TS_ERR_OK) {
+        err = LoadImage(image, hdr.size, 1);
+    }
+    if (err != TS_ERR_OK) {
+        valptr = saveval;
+    }
+    return err;
+}
+#endif
+#endif
+
+//
+// look up a function (or any other symbol) so that the application
+// can call it later with TinyScript_Call
+// returns NULL if the symbol is not defined
+//
+Sym *
+TinyScript_Lookup(const char *name)
+{
+    return LookupSym(Cstring(name));
+}
+
+//
+// call a user defined function or builtin directly from C, without
+// building and parsing a script to do it
+//
+int
+TinyScript_Call(Sym *fn, const Val *args, int nargs, Val *result)
+{
+    int typ;
+
+    if (!fn) {
+        return TS_ERR_UNKNOWN_SYM;
+    }
+    typ = fn->type & 0xff;
+    if (typ == VARFUNC) {
+        // pass the arguments on the value stack, as a script would
+        if (nargs < ((fn->type >> 8) & 0xff)) {
+            return TS_ERR_BADARGS;
+        }
+        if ((intptr_t)(valptr - nargs) < (intptr_t)symptr) {
+            return TS_ERR_NOMEM;
+        }
+        valptr -= nargs;
+        memcpy(valptr, args, nargs*sizeof(Val));
+        *result = ((Cvarfunc)fn->value)(nargs, valptr);
+        valptr += nargs;
+        return TS_ERR_OK;
+    }
+    if (nargs != ((fn->type >> 8) & 0xff)) {
+        return TS_ERR_BADARGS;
+    }
+    if (typ == USRFUNC) {
+        UserFunc *uf = (UserFunc *)fn->value;
+        int err;
+#ifdef VERBOSE_ERRORS
+        // the call may be made by a builtin while a script is running,
+        // whose errors are still to be shown against its own text
+        const char *savebuf = script_buffer;
+        script_buffer = StringGetPtr(uf->body);
+#endif
+        fResult = 0;
+        err = CallUserFunc(uf, args, result);
+#ifdef VERBOSE_ERRORS
+        script_buffer = savebuf;
+#endif
+        return err;
+    } else if (typ == BUILTIN) {
+        *result = CallBuiltin(fn->value, fn->type, args);
+        return TS_ERR_OK;
+    }
+    return TS_ERR_BADARGS;
+}
+
+#ifdef EXPR_COMPILE
+//
+// compile an expression so that it may be evaluated quickly many
+// times; every variable in the expression becomes a binding slot,
+// numbered in order of first appearance
+// returns NULL on error
+//
+CompiledExpr *
+TinyScript_CompileExpr(const char *text)
+{
+    String savepc = parseptr;
+    CompiledExpr *e;
+    Val *saveval;
+    Val *codebase;
+    Val v;
+    int err;
+    int i, ncode;
+
+#ifdef VERBOSE_ERRORS
+    script_buffer = text;
+#endif
+    parseptr = Cstring(text);
+    codeptr = codebase = (Val *)symptr;
+    codeDepth = codeMaxDepth = 0;
+    codeSlots = 0;
+    compiling = 1;
+    NextToken();
+    err = ParseExpr(&v);
+    if (err == TS_ERR_OK && curToken >= 0 && curToken != '\n' && curToken != ';') {
+        err = SyntaxError();
+    }
+    if (err == TS_ERR_OK) {
+        err = EmitCode(XOP_END, 0, 0);
+    }
+    compiling = 0;
+    parseptr = savepc;
+    if (err != TS_ERR_OK) {
+        return NULL;
+    }
+    // now move the code to permanent storage on the value stack
+    ncode = codeptr - codebase;
+    saveval = valptr;
+    e = (CompiledExpr *)stack_alloc(sizeof(*e) + ncode*sizeof(Val) + codeSlots*sizeof(String));
+    if (!e) {
+        OutOfMem();
+        return NULL;
+    }
+    e->ncode = ncode;
+    e->nslots = codeSlots;
+    e->depth = codeMaxDepth;
+    e->code = (Val *)(e + 1);
+    e->slotName = (String *)(e->code + ncode);
+    memmove(e->code, codebase, ncode*sizeof(Val));
+    for (i = 0; i < codeSlots; i++) {
+        e->slotName[i] = DupString(codeSlotName[i]);
+        if (!StringGetPtr(e->slotName[i])) {
+            // give back the expression and the names copied so far
+            valptr = saveval;
+            OutOfMem();
+            return NULL;
+        }
+    }
+    return e;
+}
+
+//
+// find the binding slot for a variable in a compiled expression
+// returns -1 if the expression does not use the variable
+//
+int
+TinyScript_ExprSlot(CompiledExpr *e, const char *name)
+{
+    int i;
+    String s = Cstring(name);
+    for (i = 0; i < e->nslots; i++) {
+        if (stringeq(e->slotName[i], s)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+//
+// evaluate a compiled expression
+// bindings[i] gives the value of the variable in slot i
+//
+int
+TinyScript_EvalExpr(CompiledExpr *e, const Val *bindings, Val *result)
+{
+    Val stack[MAX_EXPR_STACK];
+    Val *sp = stack;
+    const Val *pc = e->code;
+    Val op, arg;
+    int n;
+    int err;
+
+    for(;;) {
+        op = *pc++;
+        arg = *pc++;
+        switch (op & 0xff) {
+        case XOP_CONST:
+            *sp++ = arg;
+            break;
+        case XOP_SLOT:
+            *sp++ = bindings[arg];
+            break;
+        case XOP_BINOP:
+            --sp;
+            sp[-1] = ((Opfunc)arg)(sp[-1], sp[0]);
+            break;
+        case XOP_CALL:
+            n = (op >> 8) & 0xff;
+            sp -= n;
+            *sp = CallBuiltin(arg, op, sp);
+            sp++;
+            break;
+        case XOP_VARCALL:
+            n = op >> 8;
+            sp -= n;
+            *sp = ((Cvarfunc)arg)(n, sp);
+            sp++;
+            break;
+        case XOP_USRFUNC:
+            n = ((UserFunc *)arg)->nargs;
+            sp -= n;
+            err = CallUserFunc((UserFunc *)arg, sp, sp);
+            if (err != TS_ERR_OK) {
+                return err;
+            }
+            sp++;
+            break;
+        default:
+            *result = sp[-1];
+            return TS_ERR_OK;
+        }
+    }
+}
+#endif
+
+#ifdef EXPR_COMPILE
+//
+// batch evaluation of compiled expressions
+// every value on the evaluation stack is either a single constant
+// (p == NULL) or a block of rows
+//
+typedef struct {
+    const Val *p;
+    Val k;
+} BatchVal;
+
+static const Val *
+BatchFill(Val *buf, Val k, int n)
+{
+    int i;
+    for (i = 0; i < n; i++) buf[i] = k;
+    return buf;
+}
+
+static inline Val
+BatchGet(const BatchVal *v, int i)
+{
+    return v->p ? v->p[i] : v->k;
+}
+
+//
+// evaluate a compiled expression over nrows rows
+// the variable in slot i takes its values from columns[i], and
+// the result for each row goes into out
+// the scratch blocks are taken from the value stack, so user
+// functions called from the expression may evaluate batches too
+//
+int
+TinyScript_EvalExprBatch(CompiledExpr *e, const Val * const *columns, Val nrows, Val *out)
+{
+    Val *buf;
+    BatchVal stack[MAX_EXPR_STACK];
+    BatchVal *x, *y;
+    const Val *pc;
+    Val op, arg;
+    Val base;
+    int sp;
+    int i, j, n, nargs;
+    int err = TS_ERR_OK;
+
+    buf = (Val *)stack_alloc(e->depth * EXPR_BATCH_ROWS * sizeof(Val));
+    if (!buf) {
+        return OutOfMem();
+    }
+    for (base = 0; base < nrows; base += n) {
+        n = (nrows - base < EXPR_BATCH_ROWS) ? (int)(nrows - base) : EXPR_BATCH_ROWS;
+        pc = e->code;
+        sp = 0;
+        for(;;) {
+            op = *pc++;
+            arg = *pc++;
+            switch (op & 0xff) {
+            case XOP_CONST:
+                stack[sp].p = NULL;
+                stack[sp].k = arg;
+                sp++;
+                break;
+            case XOP_SLOT:
+                stack[sp].p = columns[arg] + base;
+                sp++;
+                break;
+            case XOP_BINOP:
+                y = &stack[--sp];
+                x = &stack[sp-1];
+                if (!x->p && !y->p) {
+                    x->k = ((Opfunc)arg)(x->k, y->k);
+                } else {
+                    const Val *xp = x->p ? x->p : BatchFill(buf + (sp-1)*EXPR_BATCH_ROWS, x->k, n);
+                    const Val *yp = y->p ? y->p : BatchFill(buf + sp*EXPR_BATCH_ROWS, y->k, n);
+                    Val *r = buf + (sp-1)*EXPR_BATCH_ROWS;
+                    if (op >> 8) {
+                        kernels[op >> 8].kernel(r, xp, yp, n);
+                    } else {
+                        for (i = 0; i < n; i++) {
+                            r[i] = ((Opfunc)arg)(xp[i], yp[i]);
+                        }
+                    }
+                    x->p = r;
+                }
+                break;
+            case XOP_CALL:
+            case XOP_VARCALL:
+            case XOP_USRFUNC:
+                nargs = ((op & 0xff) == XOP_USRFUNC) ? ((UserFunc *)arg)->nargs : ((op >> 8) & 0xff);
+                sp -= nargs;
+                for (i = 0; i < n; i++) {
+                    Val a[MAX_EXPR_STACK] = { 0 };
+                    for (j = 0; j < nargs; j++) {
+                        a[j] = BatchGet(&stack[sp+j], i);
+                    }
+                    if ((op & 0xff) == XOP_CALL) {
+                        buf[sp*EXPR_BATCH_ROWS + i] = CallBuiltin(arg, op, a);
+                    } else if ((op & 0xff) == XOP_VARCALL) {
+                        buf[sp*EXPR_BATCH_ROWS + i] = ((Cvarfunc)arg)(nargs, a);
+                    } else {
+                        err = CallUserFunc((UserFunc *)arg, a, &buf[sp*EXPR_BATCH_ROWS + i]);
+                        if (err != TS_ERR_OK) {
+                            goto done;
+                        }
+                    }
+                }
+                stack[sp].p = buf + sp*EXPR_BATCH_ROWS;
+                sp++;
+                break;
+            default:
+                if (stack[0].p) {
+                    memcpy(out + base, stack[0].p, n*sizeof(Val));
+                } else {
+                    BatchFill(out + base, stack[0].k, n);
+                }
+                goto next;
+            }
+        }
+    next:
+        ;
+    }
+done:
+    // the scratch blocks can go unless a function left something below them
+    if (valptr == buf) {
+        valptr = buf + e->depth * EXPR_BATCH_ROWS;
+    }
+    return err;
+}
+
+#ifdef ARRAY_SUPPORT
+//
+// batch evaluation where the variables and the result are all
+// tinyscript arrays (with the length in element 0)
+// the result array's length gives the number of rows
+//
+int
+TinyScript_EvalExprArrays(CompiledExpr *e, Val * const *arrays, Val *result)
+{
+    const Val *columns[MAX_EXPR_SLOTS];
+    Val nrows = result[0];
+    int i;
+
+    for (i = 0; i < e->nslots; i++) {
+        if (arrays[i][0] < nrows) {
+            return TS_ERR_OUTOFBOUNDS;
+        }
+        columns[i] = arrays[i] + 1;
+    }
+    return TinyScript_EvalExprBatch(e, columns, nrows, result + 1);
+}
+#endif
+#endif
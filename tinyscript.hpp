@@ -0,0 +1,224 @@
+#ifndef TINYSCRIPT_HPP
+#define TINYSCRIPT_HPP
+
+// C++ interface to tinyscript
+//
+// This is a thin header-only layer over the C interface in tinyscript.h;
+// it needs C++17. It provides:
+//
+//   ts::Context<N>   an interpreter with an N byte memory arena
+//   ts::define<&f>   defines C++ function f as a builtin, generating a
+//                    thunk which converts each Val to f's own parameter
+//                    types (integers, enums, bool, pointers, array_ref)
+//   ts::array_ref    typed access to an array passed to a builtin
+//
+// The thunks are ordinary functions fixed at compile time, so calling
+// a builtin costs no more than calling a C function written by hand.
+// The interpreter keeps the state of the current context in globals;
+// each Context saves its own, and its methods make it current while
+// they run and then switch back to the context which was current
+// before, so several contexts may be used side by side (and a builtin
+// running in one may use another). Constructing a context makes it the
+// current one, for code which uses the C interface directly.
+
+#include <cstddef>
+#include <type_traits>
+#include "tinyscript.h"
+
+namespace ts {
+
+// an array passed to a builtin by name; the length is in element 0
+class array_ref {
+public:
+    array_ref() : ary_(nullptr) {}
+    explicit array_ref(Val *ary) : ary_(ary) {}
+
+    Val size() const { return ary_ ? ary_[0] : 0; }
+    Val *data() const { return ary_ + 1; }
+    Val *begin() const { return ary_ + 1; }
+    Val *end() const { return ary_ + 1 + size(); }
+    Val &operator[](Val i) const { return ary_[i + 1]; }
+    // the elements are not checked on each access; use this to make sure
+    // that a value from a script really is an array
+#ifdef ARRAY_SUPPORT
+    bool valid() const { return ary_ && TinyScript_CheckArray(ary_); }
+#endif
+
+private:
+    Val *ary_;
+};
+
+namespace detail {
+
+// conversion of script values to and from C++ types
+template <typename T>
+inline T from_val(Val v)
+{
+    if constexpr (std::is_same_v<T, array_ref>) {
+        return array_ref(reinterpret_cast<Val *>(v));
+    } else if constexpr (std::is_same_v<T, bool>) {
+        return v != 0;
+    } else if constexpr (std::is_pointer_v<T>) {
+        return reinterpret_cast<T>(v);
+    } else {
+        static_assert(std::is_integral_v<T> || std::is_enum_v<T>,
+                      "builtin parameters must be integers, enums, pointers or array_ref");
+        return static_cast<T>(v);
+    }
+}
+
+template <typename T>
+inline Val to_val(T x)
+{
+    if constexpr (std::is_pointer_v<T>) {
+        return reinterpret_cast<Val>(x);
+    } else {
+        static_assert(std::is_integral_v<T> || std::is_enum_v<T>,
+                      "builtin results must be integers, enums or pointers");
+        return static_cast<Val>(x);
+    }
+}
+
+// every parameter of a thunk is a Val
+template <typename T>
+using as_val = Val;
+
+template <auto F, typename Sig>
+struct thunk;
+
+template <auto F, typename R, typename... A>
+struct thunk<F, R (*)(A...)> {
+    static_assert(sizeof...(A) <= MAX_BUILTIN_PARAMS, "too many parameters for a builtin");
+    static constexpr int type = std::is_void_v<R> ? CPROC(sizeof...(A)) : CFUNC(sizeof...(A));
+
+    static std::conditional_t<std::is_void_v<R>, void, Val> call(as_val<A>... args)
+    {
+        if constexpr (std::is_void_v<R>) {
+            F(from_val<A>(args)...);
+        } else {
+            return to_val(F(from_val<A>(args)...));
+        }
+    }
+};
+
+} // namespace detail
+
+// define F as a builtin called "name"; F must be a function (not a
+// lambda with captures) taking up to four parameters
+template <auto F>
+inline int define(const char *name)
+{
+    using thunk = detail::thunk<F, decltype(F)>;
+    return TinyScript_Define(name, thunk::type, reinterpret_cast<Val>(&thunk::call));
+}
+
+// define F, with prototype Val F(int argc, Val *argv), as a builtin
+// taking at least "minargs" arguments
+template <Val (*F)(int, Val *)>
+inline int define_variadic(const char *name, int minargs = 0)
+{
+    return TinyScript_Define(name, CVARFUNC(minargs), reinterpret_cast<Val>(F));
+}
+
+// an interpreter with an arena of N bytes
+template <std::size_t N>
+class Context {
+public:
+    Context()
+    {
+        err_ = TinyScript_Init(mem_, static_cast<int>(N));
+        TinyScript_SaveContext(&state_);
+    }
+    Context(const Context &) = delete;
+    Context &operator=(const Context &) = delete;
+
+    // TS_ERR_OK if the interpreter was initialized
+    int error() const { return err_; }
+
+    template <auto F>
+    int define(const char *name)
+    {
+        scope s(*this);
+        return ts::define<F>(name);
+    }
+
+    template <Val (*F)(int, Val *)>
+    int define_variadic(const char *name, int minargs = 0)
+    {
+        scope s(*this);
+        return ts::define_variadic<F>(name, minargs);
+    }
+
+    int run(const char *script, bool saveStrings = false, bool topLevel = true)
+    {
+        scope s(*this);
+        return TinyScript_Run(script, saveStrings, topLevel);
+    }
+
+    Sym *lookup(const char *name)
+    {
+        scope s(*this);
+        return TinyScript_Lookup(name);
+    }
+
+    // save this context, or replace it with one saved earlier
+    int snapshot(void *buf, int size)
+    {
+        scope s(*this);
+        return TinyScript_Snapshot(buf, size);
+    }
+    int clone(const void *snap)
+    {
+        scope s(*this);
+        return err_ = TinyScript_Clone(snap, mem_, static_cast<int>(N));
+    }
+
+    // call a script function or builtin; the result is placed in *result
+    template <typename... A>
+    int call(Sym *fn, Val *result, A... args)
+    {
+        scope s(*this);
+        Val argv[sizeof...(A) > 0 ? sizeof...(A) : 1] = { detail::to_val(args)... };
+        return TinyScript_Call(fn, argv, static_cast<int>(sizeof...(A)), result);
+    }
+
+private:
+    // makes a context current for as long as it lasts, and then saves
+    // its state and makes the previous context current again; nothing
+    // is switched if it is current already (as when it has just been
+    // constructed, or a builtin which it runs calls back into it), since
+    // its saved state may then be out of date
+    class scope {
+    public:
+        explicit scope(Context &ctx) : ctx_(ctx)
+        {
+            TinyScript_SaveContext(&prev_);
+            switched_ = prev_.arena != ctx_.state_.arena;
+            if (switched_) {
+                TinyScript_SwitchContext(&ctx_.state_);
+            }
+        }
+        ~scope()
+        {
+            TinyScript_SaveContext(&ctx_.state_);
+            if (switched_) {
+                TinyScript_SwitchContext(&prev_);
+            }
+        }
+        scope(const scope &) = delete;
+        scope &operator=(const scope &) = delete;
+
+    private:
+        Context &ctx_;
+        ContextState prev_;
+        bool switched_;
+    };
+
+    alignas(Val) unsigned char mem_[N];
+    ContextState state_;
+    int err_;
+};
+
+} // namespace ts
+
+#endif
@@ -31,78 +31,491 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
+#include <inttypes.h>
 #include <math.h>
 
-ts_list * ts_list_new(Val capacity) {
-  ts_list * list = ts_malloc(sizeof(ts_list));
-  list->data = ts_malloc(capacity);
+/* Memory for library objects
+ *
+ * If TS_LIB_POOL is defined, small blocks (such as list headers and
+ * short list buffers) come from slabs divided into a few size classes,
+ * which are recycled through free lists. Larger blocks, and all blocks
+ * if TS_LIB_POOL is not defined, come from ts_malloc with a small
+ * header which keeps them on a list.
+ * The size of a block must be given when it is freed.
+ *
+ * If TS_LIB_REGION is defined, the application may also open a region
+ * with ts_region_begin; lists created while it is open are bump
+ * allocated from large chunks, never freed individually, and all
+ * released together by ts_region_end. A region may be put aside with
+ * ts_region_save and another one used, as script contexts are.
+ */
+typedef struct ts_big_block {
+  struct ts_big_block * next;
+  struct ts_big_block * prev;
+  Val size;
+} ts_big_block;
+
+#define TS_BIG_HEADER ((sizeof(ts_big_block) + 15) & ~(Val)15)
+
+static ts_big_block * ts_big_blocks;
+
+static void * ts_big_alloc(Val size) {
+  ts_big_block * block = ts_malloc(TS_BIG_HEADER + size);
+  if (!block)
+    return NULL;
+  block->size = size;
+  block->prev = NULL;
+  block->next = ts_big_blocks;
+  if (ts_big_blocks)
+    ts_big_blocks->prev = block;
+  ts_big_blocks = block;
+  return (uint8_t *)block + TS_BIG_HEADER;
+}
+
+static void ts_big_free(void * p) {
+  if (!p)
+    return;
+  ts_big_block * block = (ts_big_block *)((uint8_t *)p - TS_BIG_HEADER);
+  if (block->prev)
+    block->prev->next = block->next;
+  else
+    ts_big_blocks = block->next;
+  if (block->next)
+    block->next->prev = block->prev;
+  ts_free(block);
+}
+
+#ifdef TS_LIB_POOL
+typedef struct ts_pool_block {
+  struct ts_pool_block * next;
+} ts_pool_block;
+
+typedef struct ts_slab {
+  struct ts_slab * next;
+} ts_slab;
+
+static const Val ts_pool_sizes[TS_POOL_CLASSES] = { 16, 32, 48, 64, 96, 128 };
+
+static struct ts_pool {
+  ts_pool_block * free_list;
+  ts_slab * slabs;
+  Val num_slabs;
+  Val in_use;
+  Val num_free;
+} ts_pools[TS_POOL_CLASSES];
+
+static int ts_pool_class(Val size) {
+  for (int c = 0; c < TS_POOL_CLASSES; ++c)
+    if (size <= ts_pool_sizes[c]) return c;
+  return -1;
+}
+
+/* carve a new slab into blocks for pool c */
+static bool ts_pool_grow(int c) {
+  Val block_size = ts_pool_sizes[c];
+  Val header = (sizeof(ts_slab) + 15) & ~(Val)15;
+  ts_slab * slab = ts_malloc(TS_POOL_SLAB_SIZE);
+  if (!slab)
+    return false;
+  slab->next = ts_pools[c].slabs;
+  ts_pools[c].slabs = slab;
+  ts_pools[c].num_slabs++;
+  for (Val off = header; off + block_size <= TS_POOL_SLAB_SIZE; off += block_size) {
+    ts_pool_block * block = (ts_pool_block *)((uint8_t *)slab + off);
+    block->next = ts_pools[c].free_list;
+    ts_pools[c].free_list = block;
+    ts_pools[c].num_free++;
+  }
+  return true;
+}
+
+static void * ts_heap_alloc(Val size) {
+  int c = ts_pool_class(size);
+  if (c < 0)
+    return ts_big_alloc(size);
+  if (!ts_pools[c].free_list && !ts_pool_grow(c))
+    return NULL;
+  ts_pool_block * block = ts_pools[c].free_list;
+  ts_pools[c].free_list = block->next;
+  ts_pools[c].num_free--;
+  ts_pools[c].in_use++;
+  return block;
+}
+
+static void ts_heap_free(void * p, Val size) {
+  int c = ts_pool_class(size);
+  if (c < 0) {
+    ts_big_free(p);
+    return;
+  }
+  if (!p)
+    return;
+  ts_pool_block * block = p;
+  block->next = ts_pools[c].free_list;
+  ts_pools[c].free_list = block;
+  ts_pools[c].num_free++;
+  ts_pools[c].in_use--;
+}
+
+int ts_pool_get_stats(ts_pool_stats * stats, int max) {
+  int n = (max < TS_POOL_CLASSES) ? max : TS_POOL_CLASSES;
+  for (int c = 0; c < n; ++c) {
+    stats[c].block_size = ts_pool_sizes[c];
+    stats[c].slabs = ts_pools[c].num_slabs;
+    stats[c].in_use = ts_pools[c].in_use;
+    stats[c].free = ts_pools[c].num_free;
+  }
+  return n;
+}
+#else
+#define ts_heap_alloc(size) ts_big_alloc(size)
+#define ts_heap_free(p, size) ts_big_free(p)
+#endif
+
+#ifdef TS_LIB_REGION
+typedef struct ts_region_chunk {
+  struct ts_region_chunk * next;
+  Val size;
+  Val used;
+} ts_region_chunk;
+
+#define TS_REGION_ALIGN(n) (((n) + 7) & ~(Val)7)
+#define TS_REGION_HEADER TS_REGION_ALIGN(sizeof(ts_region_chunk))
+#define TS_REGION_DEFAULT (TS_REGION_CHUNK_SIZE - TS_REGION_HEADER)
+
+static ts_region_chunk * ts_region_chunks; /* current chunk first */
+static ts_region_chunk * ts_region_spare;  /* kept for the next region */
+static bool ts_region_active;
+
+static ts_region_chunk * ts_region_new_chunk(Val size) {
+  ts_region_chunk * chunk;
+  if (size <= TS_REGION_DEFAULT && ts_region_spare) {
+    chunk = ts_region_spare;
+    ts_region_spare = NULL;
+  } else {
+    if (size < TS_REGION_DEFAULT)
+      size = TS_REGION_DEFAULT;
+    chunk = ts_malloc(TS_REGION_HEADER + size);
+    if (!chunk)
+      return NULL;
+    chunk->size = size;
+  }
+  chunk->used = 0;
+  return chunk;
+}
+
+static void * ts_region_alloc(Val size) {
+  ts_region_chunk * chunk = ts_region_chunks;
+  size = TS_REGION_ALIGN(size);
+  if (!chunk || chunk->used + size > chunk->size) {
+    ts_region_chunk * fresh = ts_region_new_chunk(size);
+    if (!fresh)
+      return NULL;
+    if (chunk && size > TS_REGION_DEFAULT / 4) {
+      /* big blocks get a chunk of their own, behind the current one */
+      fresh->next = chunk->next;
+      chunk->next = fresh;
+    } else {
+      fresh->next = chunk;
+      ts_region_chunks = fresh;
+    }
+    chunk = fresh;
+  }
+  void * p = (uint8_t *)chunk + TS_REGION_HEADER + chunk->used;
+  chunk->used += size;
+  return p;
+}
+
+bool ts_region_begin(void) {
+  if (ts_region_active)
+    return false;
+  ts_region_active = true;
+  return true;
+}
+
+void ts_region_end(void) {
+  ts_region_chunk * chunk = ts_region_chunks;
+  while (chunk) {
+    ts_region_chunk * next = chunk->next;
+    if (!ts_region_spare && chunk->size == TS_REGION_DEFAULT)
+      ts_region_spare = chunk;
+    else
+      ts_free(chunk);
+    chunk = next;
+  }
+  ts_region_chunks = NULL;
+  ts_region_active = false;
+}
+
+Val ts_region_used(void) {
+  Val used = 0;
+  for (ts_region_chunk * chunk = ts_region_chunks; chunk; chunk = chunk->next)
+    used += TS_REGION_HEADER + chunk->size;
+  return used;
+}
+
+void ts_region_save(ts_region_state * state) {
+  state->chunks = ts_region_chunks;
+  state->active = ts_region_active;
+}
+
+void ts_region_switch(const ts_region_state * state) {
+  ts_region_chunks = state->chunks;
+  ts_region_active = state->active;
+}
+#else
+#define ts_region_active false
+#define ts_region_alloc(size) NULL
+#endif
+
+/* an object's memory comes from the region if the object was created
+   while one was open, otherwise from the heap */
+static void * ts_lib_alloc(Val size, bool region) {
+  return region ? ts_region_alloc(size) : ts_heap_alloc(size);
+}
+
+static void ts_lib_free(void * p, Val size, bool region) {
+  if (!region)
+    ts_heap_free(p, size);
+}
+
+/* Scripts pass library objects as plain Vals, so a function which takes
+ * either an object or a number (such as printf) cannot just read the
+ * kind of what it is given. ts_lib_extent finds p in the pools, the
+ * current region or the list of large blocks, without reading through
+ * p, and returns how many bytes from p on are library memory (0 if p
+ * is not in library memory at all). ts_object_kind then checks that
+ * the object's header fits in that memory.
+ */
+static Val ts_lib_extent(const void * p) {
+  const uint8_t * q = p;
+  if (!p || (uintptr_t)p % sizeof(Val) != 0)
+    return 0;
+#ifdef TS_LIB_POOL
+  Val header = (sizeof(ts_slab) + 15) & ~(Val)15;
+  for (int c = 0; c < TS_POOL_CLASSES; ++c) {
+    Val block_size = ts_pool_sizes[c];
+    for (ts_slab * slab = ts_pools[c].slabs; slab; slab = slab->next) {
+      const uint8_t * first = (const uint8_t *)slab + header;
+      if (q >= first && q < (const uint8_t *)slab + TS_POOL_SLAB_SIZE) {
+        Val off = q - first;
+        Val end = off - off % block_size + block_size;
+        return header + end <= TS_POOL_SLAB_SIZE ? end - off : 0;
+      }
+    }
+  }
+#endif
+#ifdef TS_LIB_REGION
+  for (ts_region_chunk * chunk = ts_region_chunks; chunk; chunk = chunk->next) {
+    const uint8_t * start = (const uint8_t *)chunk + TS_REGION_HEADER;
+    if (q >= start && q < start + chunk->used)
+      return start + chunk->used - q;
+  }
+#endif
+  for (ts_big_block * block = ts_big_blocks; block; block = block->next) {
+    const uint8_t * start = (const uint8_t *)block + TS_BIG_HEADER;
+    if (q >= start && q < start + block->size)
+      return start + block->size - q;
+  }
+  return 0;
+}
+
+/* the kind of the object at p, or 0 if it is not one */
+static int ts_object_kind(const void * p) {
+  Val extent = ts_lib_extent(p);
+  if (extent < (Val)sizeof(ts_str))
+    return 0;
+  switch (*(const uint8_t *)p) {
+  case TS_KIND_STR: {
+    const ts_str * str = p;
+    return str->len >= 0 && str->len < extent - (Val)offsetof(ts_str, bytes) ? TS_KIND_STR : 0;
+  }
+  case TS_KIND_LIST: {
+    const ts_list * list = p;
+    if (extent < (Val)sizeof(ts_list) || list->size < 0 || list->size > list->capacity)
+      return 0;
+    return list->size == 0 || ts_lib_extent(list->data) >= list->size * list->width ? TS_KIND_LIST : 0;
+  }
+  case TS_KIND_MAP:
+    return extent >= (Val)sizeof(ts_map) ? TS_KIND_MAP : 0;
+  }
+  return 0;
+}
+
+static ts_list * ts_list_alloc(void) {
+  ts_list * list = ts_lib_alloc(sizeof(ts_list), ts_region_active);
+  if (list) {
+    list->kind = TS_KIND_LIST;
+    list->region = ts_region_active;
+  }
+  return list;
+}
+
+/* List elements are stored packed, list->width bytes each.
+   Short lists keep their elements inside the list header. */
+static uint8_t * ts_list_alloc_data(ts_list * list, Val capacity) {
+  if (capacity * list->width <= TS_LIST_INLINE)
+    return list->small;
+  return ts_lib_alloc(capacity * list->width, list->region);
+}
+
+static void ts_list_free_data(ts_list * list) {
+  if (list->data != list->small)
+    ts_lib_free(list->data, list->capacity * list->width, list->region);
+}
+
+static Val ts_list_elem(const ts_list * list, Val idx) {
+  switch (list->width) {
+  case 1: return list->data[idx];
+  case 2: return ((uint16_t *)list->data)[idx];
+  case 4: return ((int32_t *)list->data)[idx];
+  default: return ((Val *)list->data)[idx];
+  }
+}
+
+static void ts_list_set_elem(ts_list * list, Val idx, Val val) {
+  switch (list->width) {
+  case 1: list->data[idx] = (uint8_t)val; break;
+  case 2: ((uint16_t *)list->data)[idx] = (uint16_t)val; break;
+  case 4: ((int32_t *)list->data)[idx] = (int32_t)val; break;
+  default: ((Val *)list->data)[idx] = val; break;
+  }
+}
+
+/* copy n elements from src (starting at src_idx) to dst (starting at
+   dst_idx); dst must have room for them */
+static void ts_list_copy(ts_list * dst, Val dst_idx, const ts_list * src, Val src_idx, Val n) {
+  if (dst->width == src->width) {
+    memmove(dst->data + dst_idx * dst->width, src->data + src_idx * src->width, n * src->width);
+  } else {
+    for (Val i = 0; i < n; ++i)
+      ts_list_set_elem(dst, dst_idx + i, ts_list_elem(src, src_idx + i));
+  }
+}
+
+/* make sure the list has room for at least capacity elements,
+   growing it geometrically */
+static bool ts_list_reserve(ts_list * list, Val capacity) {
+  if (capacity <= list->capacity)
+    return true;
+  Val new_capacity = list->capacity * 2;
+  if (new_capacity < capacity)
+    new_capacity = capacity;
+  uint8_t * data = ts_list_alloc_data(list, new_capacity);
+  if (!data)
+    return false;
+  if (data != list->data) {
+    memcpy(data, list->data, list->size * list->width);
+    ts_list_free_data(list);
+  }
+  list->data = data;
+  list->capacity = new_capacity;
+  return true;
+}
+
+ts_list * ts_list_new_width(Val capacity, Val bits) {
+  ts_list * list = ts_list_alloc();
+  if (!list)
+    return NULL;
+  switch (bits) {
+  case 8: list->width = 1; break;
+  case 16: list->width = 2; break;
+  case 32: list->width = 4; break;
+  default: list->width = sizeof(Val); break;
+  }
+  list->data = ts_list_alloc_data(list, capacity);
+  if (!list->data) {
+    ts_lib_free(list, sizeof(ts_list), list->region);
+    return NULL;
+  }
   list->size = 0;
   list->capacity = capacity;
   return list;
 }
 
+ts_list * ts_list_new(Val capacity) {
+  return ts_list_new_width(capacity, 8);
+}
+
 ts_list * ts_list_dup(ts_list * old) {
-  ts_list * list = ts_malloc(sizeof(ts_list));
-  list->data = ts_malloc(old->capacity);
+  ts_list * list = ts_list_alloc();
+  if (!list)
+    return NULL;
+  list->width = old->width;
+  list->data = ts_list_alloc_data(list, old->capacity);
+  if (!list->data) {
+    ts_lib_free(list, sizeof(ts_list), list->region);
+    return NULL;
+  }
   list->size = old->size;
   list->capacity = old->capacity;
-  for (Val i = 0; i < old->size; ++i)
-    list->data[i] = old->data[i];
+  memcpy(list->data, old->data, old->size * old->width);
   return list;
 }
 
 void ts_list_free(ts_list * list) {
-  ts_free(list->data);
-  ts_free(list);
+  ts_list_free_data(list);
+  ts_lib_free(list, sizeof(ts_list), list->region);
+}
+
+#ifdef TS_LIB_REGION
+ts_list * ts_list_promote(ts_list * list) {
+  if (!list->region)
+    return list;
+  bool active = ts_region_active;
+  ts_region_active = false;
+  ts_list * copy = ts_list_dup(list);
+  ts_region_active = active;
+  return copy;
 }
+#endif
 
 Val ts_list_pop(ts_list * list) {
   if (list->size == 0)
     return -1;
   list->size--;
-  return list->data[list->size];
+  return ts_list_elem(list, list->size);
 }
 
-bool ts_list_push(ts_list * list, Val val) {
-  if (list->size == list->capacity)
-    return false;
-  list->data[list->size] = (uint8_t)val;
+Val ts_list_push(ts_list * list, Val val) {
+  if (list->size == list->capacity && !ts_list_reserve(list, list->size + 1))
+    return 0;
+  ts_list_set_elem(list, list->size, val);
   list->size++;
-  return true;
+  return 1;
 }
 
-bool ts_list_push_(ts_list * list, Val val1, Val val2) {
-  bool success;
+Val ts_list_push_(ts_list * list, Val val1, Val val2) {
+  Val success;
   success = ts_list_push(list, val1);
   if (success) success = ts_list_push(list, val2);
   return success;
 }
-bool ts_list_push__(ts_list * list, Val val1, Val val2, Val val3) {
-  bool success;
+Val ts_list_push__(ts_list * list, Val val1, Val val2, Val val3) {
+  Val success;
   success = ts_list_push(list, val1);
   if (success) success = ts_list_push(list, val2);
   if (success) success = ts_list_push(list, val3);
   return success;
 }
 
-bool ts_list_set(ts_list * list, Val idx, Val val) {
-  if (idx < list->capacity) {
+Val ts_list_set(ts_list * list, Val idx, Val val) {
+  if (idx >= 0 && idx < list->capacity) {
     // initialize to 0 everything that is between previous list size and new list end
     if (list->size <= idx) {
-      for (Val i = list->size; i < idx; ++i) {
-        list->data[i] = 0;
-      }
+      memset(list->data + list->size * list->width, 0, (idx - list->size) * list->width);
       list->size = idx + 1;
     }
-    list->data[idx] = (uint8_t)val;
-    return true;
+    ts_list_set_elem(list, idx, val);
+    return 1;
   }
-  return false;
+  return 0;
 }
 
 Val ts_list_get(ts_list * list, Val idx) {
-  if (idx < list->size) {
-    return list->data[idx];
+  if (idx >= 0 && idx < list->size) {
+    return ts_list_elem(list, idx);
   }
   return -1;
 }
@@ -115,57 +528,956 @@ void ts_list_truncate(ts_list * list, Val new_size) {
   if (new_size < list->size && new_size >= 0) list->size = new_size;
 }
 
+/* grows the list in place; the list is returned for compatibility
+   with older scripts which use the result */
 ts_list * ts_list_expand(ts_list * list, Val new_capacity) {
-  if (list->capacity >= new_capacity) {
-    return list;
+  if (list->capacity < new_capacity) {
+    ts_list_reserve(list, new_capacity);
   }
-  ts_list * new_list = ts_list_new(new_capacity);
-  for (int i = 0; i < list->size; ++i) {
-    new_list->data[i] = list->data[i];
-  }
-  new_list->size = list->size;
-  ts_list_free(list);
-  return new_list;
+  return list;
 }
 
+/* appends the elements of list_b to list_a in place */
+Val ts_list_append(ts_list * list_a, ts_list * list_b) {
+  Val size_b = list_b->size;
+  if (!ts_list_reserve(list_a, list_a->size + size_b))
+    return 0;
+  ts_list_copy(list_a, list_a->size, list_b, 0, size_b);
+  list_a->size += size_b;
+  return 1;
+}
+
+/* returns a new list holding the elements of list_a followed by those
+   of list_b */
 ts_list * ts_list_cat(ts_list * list_a, ts_list * list_b) {
   Val new_size = list_a->size + list_b->size;
-  ts_list *new_list = ts_list_new(new_size);
-  for (int i = 0; i < list_a->size; ++i)
-    new_list->data[i] = list_a->data[i];
-  for (int i = 0; i < list_b->size; ++i)
-    new_list->data[list_a->size + i] = list_b->data[i];
-
+  Val bits = 8 * ((list_a->width > list_b->width) ? list_a->width : list_b->width);
+  ts_list *new_list = ts_list_new_width(new_size, bits);
+  ts_list_copy(new_list, 0, list_a, 0, list_a->size);
+  ts_list_copy(new_list, list_a->size, list_b, 0, list_b->size);
   new_list->size = new_size;
 
   return new_list;
 }
 
+/* Maps
+ *
+ * Open addressing with linear probing. Keys and values are kept side
+ * by side in one table, followed by a byte per slot marking the slots
+ * in use. Deletion shifts later entries of the probe sequence back
+ * instead of leaving tombstones, so lookups never scan dead slots.
+ */
+#define TS_MAP_MIN_CAPACITY 8
+
+static Val ts_map_bytes(Val capacity) {
+  return capacity * (sizeof(ts_map_entry) + 1);
+}
+
+static Val ts_map_home(const ts_map * map, Val key) {
+  uint64_t h = (uint64_t)key * 0x9E3779B97F4A7C15ULL;
+  return (Val)(h >> 32) & (map->capacity - 1);
+}
+
+/* slot holding key, or the empty slot where it would go */
+static Val ts_map_slot(const ts_map * map, Val key) {
+  Val mask = map->capacity - 1;
+  Val i = ts_map_home(map, key);
+  while (map->used[i] && map->entries[i].key != key)
+    i = (i + 1) & mask;
+  return i;
+}
+
+static bool ts_map_alloc_table(ts_map * map, Val capacity) {
+  ts_map_entry * entries = ts_lib_alloc(ts_map_bytes(capacity), map->region);
+  if (!entries)
+    return false;
+  map->entries = entries;
+  map->used = (uint8_t *)(entries + capacity);
+  map->capacity = capacity;
+  memset(map->used, 0, capacity);
+  return true;
+}
+
+static bool ts_map_rehash(ts_map * map, Val capacity) {
+  ts_map_entry * old_entries = map->entries;
+  uint8_t * old_used = map->used;
+  Val old_capacity = map->capacity;
+  if (!ts_map_alloc_table(map, capacity))
+    return false;
+  for (Val i = 0; i < old_capacity; ++i) {
+    if (old_used[i]) {
+      Val j = ts_map_slot(map, old_entries[i].key);
+      map->entries[j] = old_entries[i];
+      map->used[j] = 1;
+    }
+  }
+  ts_lib_free(old_entries, ts_map_bytes(old_capacity), map->region);
+  return true;
+}
+
+ts_map * ts_map_new(Val capacity) {
+  ts_map * map = ts_lib_alloc(sizeof(ts_map), ts_region_active);
+  if (!map)
+    return NULL;
+  map->kind = TS_KIND_MAP;
+  map->region = ts_region_active;
+  map->size = 0;
+  /* room for capacity keys without growing */
+  Val slots = TS_MAP_MIN_CAPACITY;
+  while (slots * 3 / 4 < capacity)
+    slots *= 2;
+  if (!ts_map_alloc_table(map, slots)) {
+    ts_lib_free(map, sizeof(ts_map), map->region);
+    return NULL;
+  }
+  return map;
+}
+
+void ts_map_free(ts_map * map) {
+  ts_lib_free(map->entries, ts_map_bytes(map->capacity), map->region);
+  ts_lib_free(map, sizeof(ts_map), map->region);
+}
+
+#ifdef TS_LIB_REGION
+ts_map * ts_map_promote(ts_map * map) {
+  if (!map->region)
+    return map;
+  ts_map * copy = ts_lib_alloc(sizeof(ts_map), false);
+  if (!copy)
+    return NULL;
+  *copy = *map;
+  copy->region = false;
+  if (!ts_map_alloc_table(copy, map->capacity)) {
+    ts_lib_free(copy, sizeof(ts_map), false);
+    return NULL;
+  }
+  memcpy(copy->entries, map->entries, ts_map_bytes(map->capacity));
+  return copy;
+}
+#endif
+
+Val ts_map_get(ts_map * map, Val key) {
+  Val i = ts_map_slot(map, key);
+  return map->used[i] ? map->entries[i].value : -1;
+}
+
+Val ts_map_has(ts_map * map, Val key) {
+  return map->used[ts_map_slot(map, key)] != 0;
+}
+
+Val ts_map_set(ts_map * map, Val key, Val value) {
+  Val i = ts_map_slot(map, key);
+  if (!map->used[i]) {
+    if ((map->size + 1) * 4 > map->capacity * 3) {
+      if (!ts_map_rehash(map, map->capacity * 2))
+        return false;
+      i = ts_map_slot(map, key);
+    }
+    map->entries[i].key = key;
+    map->used[i] = 1;
+    map->size++;
+  }
+  map->entries[i].value = value;
+  return true;
+}
+
+Val ts_map_del(ts_map * map, Val key) {
+  Val mask = map->capacity - 1;
+  Val i = ts_map_slot(map, key);
+  if (!map->used[i])
+    return false;
+  /* move back any entry which could not be found across the hole */
+  for (Val j = (i + 1) & mask; map->used[j]; j = (j + 1) & mask) {
+    Val home = ts_map_home(map, map->entries[j].key);
+    if (((j - home) & mask) >= ((j - i) & mask)) {
+      map->entries[i] = map->entries[j];
+      i = j;
+    }
+  }
+  map->used[i] = 0;
+  map->size--;
+  return true;
+}
+
+Val ts_map_size(ts_map * map) {
+  return map->size;
+}
+
+Val ts_map_iter(ts_map * map, Val idx) {
+  if (idx < 0)
+    idx = 0;
+  for (; idx < map->capacity; ++idx)
+    if (map->used[idx])
+      return idx;
+  return -1;
+}
+
+Val ts_map_key(ts_map * map, Val idx) {
+  if (idx >= 0 && idx < map->capacity && map->used[idx])
+    return map->entries[idx].key;
+  return -1;
+}
+
+Val ts_map_value(ts_map * map, Val idx) {
+  if (idx >= 0 && idx < map->capacity && map->used[idx])
+    return map->entries[idx].value;
+  return -1;
+}
+
+/* Strings
+ *
+ * Strings are immutable: a length and hash followed by the bytes and a
+ * terminating NUL, so that the bytes may be handed to C code directly.
+ * String literals in scripts are interned, i.e. kept in a hash table so
+ * that there is only ever one copy of each; two interned strings are
+ * equal only if they are the same string. Strings made at run time are
+ * not interned unless asked for, and may be freed.
+ */
+static ts_str ** ts_intern_table;
+static Val ts_intern_capacity;
+static Val ts_intern_count;
+
+static uint32_t ts_str_hash_bytes(const char * bytes, Val len) {
+  uint32_t h = 2166136261u;
+  for (Val i = 0; i < len; ++i)
+    h = (h ^ (uint8_t)bytes[i]) * 16777619u;
+  return h;
+}
+
+static Val ts_str_bytes(Val len) {
+  return sizeof(ts_str) + len + 1;
+}
+
+static ts_str * ts_str_alloc(Val len, bool region) {
+  ts_str * str = ts_lib_alloc(ts_str_bytes(len), region);
+  if (!str)
+    return NULL;
+  str->kind = TS_KIND_STR;
+  str->len = len;
+  str->interned = 0;
+  str->region = region;
+  str->bytes[len] = '\0';
+  return str;
+}
+
+ts_str * ts_str_new(const char * bytes, Val len) {
+  ts_str * str = ts_str_alloc(len, ts_region_active);
+  if (!str)
+    return NULL;
+  memcpy(str->bytes, bytes, len);
+  str->hash = ts_str_hash_bytes(bytes, len);
+  return str;
+}
+
+static bool ts_intern_grow(void) {
+  Val capacity = ts_intern_capacity ? ts_intern_capacity * 2 : 64;
+  ts_str ** table = ts_malloc(capacity * sizeof(ts_str *));
+  if (!table)
+    return false;
+  memset(table, 0, capacity * sizeof(ts_str *));
+  for (Val i = 0; i < ts_intern_capacity; ++i) {
+    ts_str * str = ts_intern_table[i];
+    if (str) {
+      Val j = str->hash & (capacity - 1);
+      while (table[j])
+        j = (j + 1) & (capacity - 1);
+      table[j] = str;
+    }
+  }
+  if (ts_intern_table)
+    ts_free(ts_intern_table);
+  ts_intern_table = table;
+  ts_intern_capacity = capacity;
+  return true;
+}
+
+/* interned strings live on the heap, whether or not a region is open */
+ts_str * ts_str_intern(const char * bytes, Val len) {
+  if ((ts_intern_count + 1) * 4 > ts_intern_capacity * 3 && !ts_intern_grow())
+    return NULL;
+  uint32_t hash = ts_str_hash_bytes(bytes, len);
+  Val mask = ts_intern_capacity - 1;
+  Val i = hash & mask;
+  for (ts_str * str; (str = ts_intern_table[i]) != NULL; i = (i + 1) & mask) {
+    if (str->hash == hash && str->len == len && !memcmp(str->bytes, bytes, len))
+      return str;
+  }
+  ts_str * str = ts_str_alloc(len, false);
+  if (!str)
+    return NULL;
+  memcpy(str->bytes, bytes, len);
+  str->hash = hash;
+  str->interned = 1;
+  ts_intern_table[i] = str;
+  ts_intern_count++;
+  return str;
+}
+
+void ts_str_free(ts_str * str) {
+  if (!str->interned)
+    ts_lib_free(str, ts_str_bytes(str->len), str->region);
+}
+
+#ifdef TS_LIB_REGION
+ts_str * ts_str_promote(ts_str * str) {
+  if (!str->region)
+    return str;
+  ts_str * copy = ts_str_alloc(str->len, false);
+  if (!copy)
+    return NULL;
+  memcpy(copy->bytes, str->bytes, str->len);
+  copy->hash = str->hash;
+  return copy;
+}
+#endif
+
+Val ts_str_len(ts_str * str) {
+  return str->len;
+}
+
+Val ts_str_eq(ts_str * a, ts_str * b) {
+  if (a == b)
+    return 1;
+  if ((a->interned && b->interned) || a->hash != b->hash || a->len != b->len)
+    return 0;
+  return !memcmp(a->bytes, b->bytes, a->len);
+}
+
+Val ts_str_get(ts_str * str, Val idx) {
+  if (idx >= 0 && idx < str->len)
+    return (uint8_t)str->bytes[idx];
+  return -1;
+}
+
+ts_str * ts_str_cat(ts_str * a, ts_str * b) {
+  ts_str * str = ts_str_alloc(a->len + b->len, ts_region_active);
+  if (!str)
+    return NULL;
+  memcpy(str->bytes, a->bytes, a->len);
+  memcpy(str->bytes + a->len, b->bytes, b->len);
+  str->hash = ts_str_hash_bytes(str->bytes, str->len);
+  return str;
+}
+
+ts_str * ts_str_to_interned(ts_str * str) {
+  return str->interned ? str : ts_str_intern(str->bytes, str->len);
+}
+
+ts_list * ts_str_to_list(ts_str * str) {
+  return ts_bytes_to_list(str->bytes, str->len);
+}
+
+ts_str * ts_str_from_list(ts_list * list) {
+  ts_str * str = ts_str_alloc(list->size, ts_region_active);
+  if (!str)
+    return NULL;
+  for (Val i = 0; i < list->size; ++i)
+    str->bytes[i] = (char)ts_list_elem(list, i);
+  str->hash = ts_str_hash_bytes(str->bytes, str->len);
+  return str;
+}
+
+/* string literals in scripts; \n, \t and \\ are turned into newline,
+   tab and backslash */
+static Val ts_str_literal(const char * ptr, unsigned len) {
+  if (!memchr(ptr, '\\', len))
+    return (Val)ts_str_intern(ptr, len);
+  char * buf = ts_malloc(len);
+  if (!buf)
+    return 0;
+  Val n = 0;
+  for (unsigned i = 0; i < len; ++i) {
+    char c = ptr[i];
+    if (c == '\\' && i + 1 < len) {
+      c = ptr[++i];
+      if (c == 'n') c = '\n';
+      else if (c == 't') c = '\t';
+    }
+    buf[n++] = c;
+  }
+  ts_str * str = ts_str_intern(buf, n);
+  ts_free(buf);
+  return (Val)str;
+}
 
 ts_list * ts_string_to_list(const char * str) {
   Val len = strlen(str);
   ts_list * list = ts_list_new(len + 1);
-  for (Val i = 0; i < len; ++i)
-    ts_list_push(list, str[i]);
-  ts_list_push(list, '\0');
+  memcpy(list->data, str, len + 1);
+  list->size = len + 1;
   return list;
 }
 
 ts_list * ts_bytes_to_list(const char * str, int num_bytes) {
   ts_list * list = ts_list_new(num_bytes);
-  for (Val i = 0; i < num_bytes; ++i)
-    ts_list_push(list, str[i]);
+  memcpy(list->data, str, num_bytes);
+  list->size = num_bytes;
   return list;
 }
 
 char * ts_list_to_string(const ts_list *list) {
   char *str = ts_malloc(list->size + 1);
-  for (Val i = 0; i < list->size; ++i)
-    str[i] = list->data[i];
+  if (list->width == 1) {
+    memcpy(str, list->data, list->size);
+  } else {
+    for (Val i = 0; i < list->size; ++i)
+      str[i] = (char)ts_list_elem(list, i);
+  }
   str[list->size] = '\0';
   return str;
 }
 
+/* Formatted output
+ *
+ * A format is parsed into a list of operations, each either a run of
+ * literal text or a single conversion, and kept in a small cache keyed
+ * by the format's handle. Interned strings never change, so for them
+ * the handle identifies the format; for lists and other strings the
+ * text is kept in the cache as well and compared, so that a format
+ * which has been changed (or freed, and its memory reused) since it
+ * was parsed is noticed. Nothing is allocated: output is collected in
+ * a buffer which is passed to the output function at the end of each
+ * call, or whenever it fills up.
+ */
+#define TS_FORMAT_OPS 16
+#define TS_FORMAT_TEXT 64
+
+enum { TS_FMT_LEFT = 1, TS_FMT_PLUS = 2, TS_FMT_SPACE = 4, TS_FMT_ALT = 8, TS_FMT_ZERO = 16 };
+
+typedef struct ts_format_op {
+  char conv;          /* conversion character, or 0 for literal text */
+  uint8_t flags;
+  int8_t width;       /* -1 if not given */
+  int8_t prec;
+  Val start;          /* literal text: where it is in the format */
+  Val len;
+} ts_format_op;
+
+typedef struct ts_format_entry {
+  const void * handle;
+  Val len;
+  uint8_t nops;
+  char text[TS_FORMAT_TEXT];
+  ts_format_op ops[TS_FORMAT_OPS];
+} ts_format_entry;
+
+static ts_format_entry ts_format_cache[TS_FORMAT_CACHE];
+
+static char ts_out_buf[TS_OUTPUT_BUFFER];
+static Val ts_out_len;
+static Val ts_out_total;
+static ts_output_fn ts_output;
+
+void ts_set_output(ts_output_fn fn) {
+  ts_output = fn;
+}
+
+void ts_flush_output(void) {
+  if (ts_output) {
+    ts_output(ts_out_buf, ts_out_len);
+  } else {
+    for (Val i = 0; i < ts_out_len; ++i)
+      outchar(ts_out_buf[i]);
+  }
+  ts_out_len = 0;
+}
+
+static void ts_out_write(const char * p, Val n) {
+  while (n > 0) {
+    if (ts_out_len == TS_OUTPUT_BUFFER)
+      ts_flush_output();
+    Val chunk = TS_OUTPUT_BUFFER - ts_out_len;
+    if (chunk > n)
+      chunk = n;
+    memcpy(ts_out_buf + ts_out_len, p, chunk);
+    ts_out_len += chunk;
+    ts_out_total += chunk;
+    p += chunk;
+    n -= chunk;
+  }
+}
+
+static void ts_out_pad(Val n) {
+  while (n-- > 0)
+    ts_out_write(" ", 1);
+}
+
+/* reads up to two digits; returns -1 if there are none */
+static int ts_format_number(const char * text, Val len, Val * pos) {
+  int n = -1;
+  for (int digits = 0; digits < 2 && *pos < len && text[*pos] >= '0' && text[*pos] <= '9'; ++digits)
+    n = (n < 0 ? 0 : n * 10) + (text[(*pos)++] - '0');
+  return n;
+}
+
+/* parses one conversion, starting just after the '%'; returns false
+   if it is not one we understand */
+static bool ts_format_conv(const char * text, Val len, Val * pos, ts_format_op * op) {
+  op->flags = 0;
+  for (; *pos < len; ++*pos) {
+    char c = text[*pos];
+    if (c == '-') op->flags |= TS_FMT_LEFT;
+    else if (c == '+') op->flags |= TS_FMT_PLUS;
+    else if (c == ' ') op->flags |= TS_FMT_SPACE;
+    else if (c == '#') op->flags |= TS_FMT_ALT;
+    else if (c == '0') op->flags |= TS_FMT_ZERO;
+    else break;
+  }
+  op->width = ts_format_number(text, len, pos);
+  op->prec = -1;
+  if (*pos < len && text[*pos] == '.') {
+    ++*pos;
+    op->prec = ts_format_number(text, len, pos);
+    if (op->prec < 0)
+      op->prec = 0;
+  }
+  /* every argument is a Val, so length modifiers mean nothing */
+  while (*pos < len && strchr("hlLjzt", text[*pos]))
+    ++*pos;
+  if (*pos >= len || !strchr("diuxXocs", text[*pos]))
+    return false;
+  op->conv = text[(*pos)++];
+  return true;
+}
+
+/* parses text from *pos into at most max operations, returning how
+   many; *pos is left where parsing stopped */
+static int ts_format_parse(const char * text, Val len, Val * pos, ts_format_op * ops, int max) {
+  int n = 0;
+  while (*pos < len && n < max) {
+    ts_format_op * op = &ops[n++];
+    Val start = *pos;
+    op->conv = 0;
+    if (text[start] == '%') {
+      Val after = start + 1;
+      if (after < len && text[after] == '%') {
+        op->start = after;
+        op->len = 1;
+        *pos = after + 1;
+        continue;
+      }
+      *pos = after;
+      if (ts_format_conv(text, len, pos, op))
+        continue;
+      /* not a conversion: print it as it is */
+      op->conv = 0;
+      if (*pos < len)
+        ++*pos;
+    } else {
+      const char * pct = memchr(text + start, '%', len - start);
+      *pos = pct ? pct - text : len;
+    }
+    op->start = start;
+    op->len = *pos - start;
+  }
+  return n;
+}
+
+static void ts_format_value(const ts_format_op * op, Val arg);
+
+/* prints a string or a list of bytes; anything else is printed as a
+   number, as %d would */
+static void ts_format_string(const ts_format_op * op, Val arg) {
+  const char * p;
+  Val n;
+  int kind = ts_object_kind((void *)arg);
+  if (kind == TS_KIND_STR) {
+    p = ((ts_str *)arg)->bytes;
+    n = ((ts_str *)arg)->len;
+  } else if (kind == TS_KIND_LIST && ((ts_list *)arg)->width == 1) {
+    p = (const char *)((ts_list *)arg)->data;
+    n = ((ts_list *)arg)->size;
+  } else {
+    ts_format_op num = *op;
+    num.conv = 'd';
+    ts_format_value(&num, arg);
+    return;
+  }
+  if (op->prec >= 0 && n > op->prec)
+    n = op->prec;
+  Val pad = op->width - n;
+  if (!(op->flags & TS_FMT_LEFT))
+    ts_out_pad(pad);
+  ts_out_write(p, n);
+  if (op->flags & TS_FMT_LEFT)
+    ts_out_pad(pad);
+}
+
+static void ts_format_value(const ts_format_op * op, Val arg) {
+  char spec[24];
+  char out[128];
+  char * q = spec;
+  *q++ = '%';
+  if (op->flags & TS_FMT_LEFT) *q++ = '-';
+  if (op->flags & TS_FMT_PLUS) *q++ = '+';
+  if (op->flags & TS_FMT_SPACE) *q++ = ' ';
+  if (op->flags & TS_FMT_ALT) *q++ = '#';
+  if (op->flags & TS_FMT_ZERO) *q++ = '0';
+  if (op->width >= 0) q += sprintf(q, "%d", op->width);
+  if (op->prec >= 0) q += sprintf(q, ".%d", op->prec);
+  int n;
+  switch (op->conv) {
+  case 'c':
+    *q++ = 'c'; *q = '\0';
+    n = snprintf(out, sizeof(out), spec, (int)arg);
+    break;
+  case 'd': case 'i':
+    strcpy(q, PRIdPTR);
+    n = snprintf(out, sizeof(out), spec, arg);
+    break;
+  default:
+    switch (op->conv) {
+    case 'u': strcpy(q, PRIuPTR); break;
+    case 'x': strcpy(q, PRIxPTR); break;
+    case 'X': strcpy(q, PRIXPTR); break;
+    default: strcpy(q, PRIoPTR); break;
+    }
+    n = snprintf(out, sizeof(out), spec, (uintptr_t)arg);
+    break;
+  }
+  if (n > 0)
+    ts_out_write(out, n < (int)sizeof(out) ? n : (int)sizeof(out) - 1);
+}
+
+static void ts_format_run(const char * text, const ts_format_op * ops, int n, const Val * args, int nargs, int * argi) {
+  for (int i = 0; i < n; ++i) {
+    const ts_format_op * op = &ops[i];
+    if (!op->conv) {
+      ts_out_write(text + op->start, op->len);
+      continue;
+    }
+    Val arg = (*argi < nargs) ? args[*argi] : 0;
+    ++*argi;
+    if (op->conv == 's')
+      ts_format_string(op, arg);
+    else
+      ts_format_value(op, arg);
+  }
+}
+
+Val ts_format(void * format, const Val * args, int nargs) {
+  const char * text;
+  Val len;
+  bool immutable = false;
+  ts_format_entry * entry = &ts_format_cache[((uintptr_t)format / sizeof(Val)) % TS_FORMAT_CACHE];
+  /* a format seen before is not looked for again */
+  int kind = entry->handle == format ? *(uint8_t *)format : ts_object_kind(format);
+  if (kind == TS_KIND_STR) {
+    ts_str * str = format;
+    text = str->bytes;
+    len = str->len;
+    immutable = str->interned;
+  } else if (kind == TS_KIND_LIST) {
+    ts_list * list = format;
+    if (list->width != 1) {
+      /* rare enough to do the slow way */
+      char * copy = ts_list_to_string(list);
+      ts_str * str = copy ? ts_str_intern(copy, strlen(copy)) : NULL;
+      if (copy)
+        ts_free(copy);
+      return str ? ts_format(str, args, nargs) : 0;
+    }
+    text = (const char *)list->data;
+    len = list->size;
+  } else {
+    return 0;
+  }
+  /* formats made from C strings may include the terminating NUL */
+  const char * nul = memchr(text, '\0', len);
+  if (nul)
+    len = nul - text;
+
+  Val written = ts_out_total;
+  int argi = 0;
+  bool cached = entry->handle == format && entry->len == len
+    && (immutable || !memcmp(entry->text, text, len));
+  if (!cached && len <= TS_FORMAT_TEXT) {
+    Val pos = 0;
+    int n = ts_format_parse(text, len, &pos, entry->ops, TS_FORMAT_OPS);
+    if (pos == len) {
+      memcpy(entry->text, text, len);
+      entry->handle = format;
+      entry->len = len;
+      entry->nops = n;
+      cached = true;
+    } else {
+      entry->handle = NULL;
+    }
+  }
+  if (cached) {
+    ts_format_run(entry->text, entry->ops, entry->nops, args, nargs, &argi);
+  } else {
+    /* too long to cache: parse and print a few operations at a time */
+    ts_format_op ops[TS_FORMAT_OPS];
+    Val pos = 0;
+    while (pos < len) {
+      int n = ts_format_parse(text, len, &pos, ops, TS_FORMAT_OPS);
+      ts_format_run(text, ops, n, args, nargs, &argi);
+    }
+  }
+  ts_flush_output();
+  return ts_out_total - written;
+}
+
+/* printf is variadic: argv[0] is the format */
+Val ts_printf_v(int argc, Val * argv) {
+  return ts_format((void *)argv[0], argv + 1, argc - 1);
+}
+
+Val ts_printf(void * format, Val a) {
+  Val args[1] = { a };
+  return ts_format(format, args, 1);
+}
+
+Val ts_printf_(void * format, Val a, Val b) {
+  Val args[2] = { a, b };
+  return ts_format(format, args, 2);
+}
+
+Val ts_printf__(void * format, Val a, Val b, Val c) {
+  Val args[3] = { a, b, c };
+  return ts_format(format, args, 3);
+}
+
+#ifdef ARRAY_SUPPORT
+/* Array functions
+ *
+ * Arrays are passed as pointers to the length, which is followed by
+ * the elements. The loops are kept simple so that the compiler can
+ * vectorize them. Functions return -1 if passed something which is
+ * not an array.
+ */
+
+static bool ts_array_ok(Val * ary) {
+  return ary && TinyScript_CheckArray(ary);
+}
+
+Val ts_array_sum(Val * ary) {
+  if (!ts_array_ok(ary)) return -1;
+  Val len = ary[0];
+  Val sum = 0;
+  for (Val i = 1; i <= len; ++i)
+    sum += ary[i];
+  return sum;
+}
+
+Val ts_array_min(Val * ary) {
+  if (!ts_array_ok(ary) || ary[0] == 0) return -1;
+  Val len = ary[0];
+  Val min = ary[1];
+  for (Val i = 2; i <= len; ++i)
+    min = (ary[i] < min) ? ary[i] : min;
+  return min;
+}
+
+Val ts_array_max(Val * ary) {
+  if (!ts_array_ok(ary) || ary[0] == 0) return -1;
+  Val len = ary[0];
+  Val max = ary[1];
+  for (Val i = 2; i <= len; ++i)
+    max = (ary[i] > max) ? ary[i] : max;
+  return max;
+}
+
+Val ts_array_fill(Val * ary, Val val) {
+  if (!ts_array_ok(ary)) return -1;
+  Val len = ary[0];
+  for (Val i = 1; i <= len; ++i)
+    ary[i] = val;
+  return len;
+}
+
+/* copy n elements of src, starting at index start, to the start of dst */
+Val ts_array_copy(Val * dst, Val * src, Val start, Val n) {
+  if (!ts_array_ok(dst) || !ts_array_ok(src)) return -1;
+  if (start < 0 || n < 0 || n > dst[0] || start > src[0] - n) return -1;
+  memmove(dst + 1, src + 1 + start, n * sizeof(Val));
+  return n;
+}
+
+/* dot product over the length of the shorter array */
+Val ts_array_dot(Val * a, Val * b) {
+  if (!ts_array_ok(a) || !ts_array_ok(b)) return -1;
+  Val len = (a[0] < b[0]) ? a[0] : b[0];
+  Val dot = 0;
+  for (Val i = 1; i <= len; ++i)
+    dot += a[i] * b[i];
+  return dot;
+}
+
+Val ts_array_count(Val * ary, Val val) {
+  if (!ts_array_ok(ary)) return -1;
+  Val len = ary[0];
+  Val count = 0;
+  for (Val i = 1; i <= len; ++i)
+    count += (ary[i] == val);
+  return count;
+}
+
+/* index of the first element equal to val, or -1 */
+Val ts_array_find(Val * ary, Val val) {
+  if (!ts_array_ok(ary)) return -1;
+  Val len = ary[0];
+  for (Val i = 1; i <= len; ++i)
+    if (ary[i] == val) return i - 1;
+  return -1;
+}
+
+/* Sorting
+ *
+ * Short arrays are sorted with an introsort (quicksort which falls back
+ * to heapsort if it recurses too deeply, and insertion sort for short
+ * runs). Long arrays are sorted with a radix sort if a temporary buffer
+ * can be allocated.
+ */
+#define TS_SORT_SHORT 16   /* use insertion sort below this length */
+#define TS_SORT_RADIX 256  /* use radix sort from this length on */
+
+static void ts_insertion_sort(Val * a, Val n) {
+  for (Val i = 1; i < n; ++i) {
+    Val x = a[i];
+    Val j = i;
+    while (j > 0 && a[j - 1] > x) {
+      a[j] = a[j - 1];
+      --j;
+    }
+    a[j] = x;
+  }
+}
+
+static void ts_sift_down(Val * a, Val root, Val n) {
+  Val x = a[root];
+  for (;;) {
+    Val child = 2 * root + 1;
+    if (child >= n) break;
+    if (child + 1 < n && a[child + 1] > a[child]) child++;
+    if (a[child] <= x) break;
+    a[root] = a[child];
+    root = child;
+  }
+  a[root] = x;
+}
+
+static void ts_heap_sort(Val * a, Val n) {
+  for (Val i = n / 2; i > 0; --i)
+    ts_sift_down(a, i - 1, n);
+  for (Val i = n - 1; i > 0; --i) {
+    Val x = a[0];
+    a[0] = a[i];
+    a[i] = x;
+    ts_sift_down(a, 0, i);
+  }
+}
+
+static void ts_intro_sort(Val * a, Val n, int depth) {
+  while (n > TS_SORT_SHORT) {
+    if (depth-- == 0) {
+      ts_heap_sort(a, n);
+      return;
+    }
+    /* median of three pivot */
+    Val x = a[0], y = a[n / 2], z = a[n - 1];
+    Val pivot = (x < y) ? ((y < z) ? y : (x < z) ? z : x)
+                        : ((x < z) ? x : (y < z) ? z : y);
+    Val i = 0, j = n - 1;
+    for (;;) {
+      while (a[i] < pivot) i++;
+      while (a[j] > pivot) j--;
+      if (i >= j) break;
+      Val t = a[i];
+      a[i] = a[j];
+      a[j] = t;
+      i++;
+      j--;
+    }
+    /* recurse into the smaller part, loop on the larger */
+    if (j + 1 < n - j - 1) {
+      ts_intro_sort(a, j + 1, depth);
+      a += j + 1;
+      n -= j + 1;
+    } else {
+      ts_intro_sort(a + j + 1, n - j - 1, depth);
+      n = j + 1;
+    }
+  }
+  ts_insertion_sort(a, n);
+}
+
+/* least significant digit first radix sort on bytes; returns false
+   if no memory is available for the temporary buffer */
+static bool ts_radix_sort(Val * a, Val n) {
+  const uintptr_t sign = (uintptr_t)1 << (8 * sizeof(Val) - 1);
+  Val * tmp = ts_malloc(n * sizeof(Val));
+  Val * src = a;
+  Val * dst = tmp;
+  Val count[256];
+
+  if (!tmp) return false;
+  for (unsigned shift = 0; shift < 8 * sizeof(Val); shift += 8) {
+    memset(count, 0, sizeof(count));
+    for (Val i = 0; i < n; ++i)
+      count[(((uintptr_t)src[i] ^ sign) >> shift) & 0xff]++;
+    /* skip the pass if every element has the same digit */
+    if (count[(((uintptr_t)src[0] ^ sign) >> shift) & 0xff] == n)
+      continue;
+    Val pos = 0;
+    for (int d = 0; d < 256; ++d) {
+      Val c = count[d];
+      count[d] = pos;
+      pos += c;
+    }
+    for (Val i = 0; i < n; ++i)
+      dst[count[(((uintptr_t)src[i] ^ sign) >> shift) & 0xff]++] = src[i];
+    Val * t = src;
+    src = dst;
+    dst = t;
+  }
+  if (src != a)
+    memcpy(a, src, n * sizeof(Val));
+  ts_free(tmp);
+  return true;
+}
+
+/* sort an array in place into ascending order */
+Val ts_array_sort(Val * ary) {
+  if (!ts_array_ok(ary)) return -1;
+  Val n = ary[0];
+  if (n >= TS_SORT_RADIX && ts_radix_sort(ary + 1, n))
+    return n;
+  int depth = 0;
+  for (Val m = n; m > 1; m >>= 1)
+    depth += 2;
+  ts_intro_sort(ary + 1, n, depth);
+  return n;
+}
+
+/* index of the first element of a sorted array which is >= val
+   (or the length of the array if there is none) */
+Val ts_array_lower_bound(Val * ary, Val val) {
+  if (!ts_array_ok(ary)) return -1;
+  Val lo = 0, hi = ary[0];
+  while (lo < hi) {
+    Val mid = lo + (hi - lo) / 2;
+    if (ary[mid + 1] < val) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo;
+}
+
+/* index of the first element of a sorted array which is > val
+   (or the length of the array if there is none) */
+Val ts_array_upper_bound(Val * ary, Val val) {
+  if (!ts_array_ok(ary)) return -1;
+  Val lo = 0, hi = ary[0];
+  while (lo < hi) {
+    Val mid = lo + (hi - lo) / 2;
+    if (ary[mid + 1] <= val) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo;
+}
+#endif
+
 Val ts_not(Val value) {
   return !value;
 }
@@ -174,14 +1486,25 @@ Val ts_bool(Val value) {
   return !!value;
 }
 
+/* frees a list, map or string; objects may be in a pool block or a
+   region rather than from ts_malloc, so this goes by their kind */
+static void ts_object_free(void * obj) {
+  switch (ts_object_kind(obj)) {
+  case TS_KIND_LIST: ts_list_free(obj); break;
+  case TS_KIND_MAP: ts_map_free(obj); break;
+  case TS_KIND_STR: ts_str_free(obj); break;
+  }
+}
+
 int ts_define_funcs() {
   int err = 0;
   err |= TinyScript_Define("not", CFUNC(1), (Val)ts_not);
   err |= TinyScript_Define("bool", CFUNC(1), (Val)ts_bool);
 
   err |= TinyScript_Define("list_new", CFUNC(1), (Val)ts_list_new);
+  err |= TinyScript_Define("list_new_width", CFUNC(2), (Val)ts_list_new_width);
   err |= TinyScript_Define("list_dup", CFUNC(1), (Val)ts_list_dup);
-  err |= TinyScript_Define("list_free", CFUNC(1), (Val)ts_list_free);
+  err |= TinyScript_Define("list_free", CPROC(1), (Val)ts_list_free);
   err |= TinyScript_Define("list_pop", CFUNC(1), (Val)ts_list_pop);
   err |= TinyScript_Define("list_get", CFUNC(2), (Val)ts_list_get);
   err |= TinyScript_Define("list_push", CFUNC(2), (Val)ts_list_push);
@@ -189,10 +1512,50 @@ int ts_define_funcs() {
   err |= TinyScript_Define("list_push__", CFUNC(4), (Val)ts_list_push__);
   err |= TinyScript_Define("list_set", CFUNC(3), (Val)ts_list_set);
   err |= TinyScript_Define("list_size", CFUNC(1), (Val)ts_list_size);
-  err |= TinyScript_Define("list_truncate", CFUNC(2), (Val)ts_list_truncate);
+  err |= TinyScript_Define("list_truncate", CPROC(2), (Val)ts_list_truncate);
   err |= TinyScript_Define("list_expand", CFUNC(2), (Val)ts_list_expand);
   err |= TinyScript_Define("list_cat", CFUNC(2), (Val)ts_list_cat);
+  err |= TinyScript_Define("list_append", CFUNC(2), (Val)ts_list_append);
+
+  err |= TinyScript_Define("str_len", CFUNC(1), (Val)ts_str_len);
+  err |= TinyScript_Define("str_eq", CFUNC(2), (Val)ts_str_eq);
+  err |= TinyScript_Define("str_get", CFUNC(2), (Val)ts_str_get);
+  err |= TinyScript_Define("str_cat", CFUNC(2), (Val)ts_str_cat);
+  err |= TinyScript_Define("str_intern", CFUNC(1), (Val)ts_str_to_interned);
+  err |= TinyScript_Define("str_free", CPROC(1), (Val)ts_str_free);
+  err |= TinyScript_Define("str_to_list", CFUNC(1), (Val)ts_str_to_list);
+  err |= TinyScript_Define("str_from_list", CFUNC(1), (Val)ts_str_from_list);
+  TinyScript_SetStringHandler(ts_str_literal);
+
+  err |= TinyScript_Define("printf", CVARFUNC(1), (Val)ts_printf_v);
+  err |= TinyScript_Define("printf_", CFUNC(3), (Val)ts_printf_);
+  err |= TinyScript_Define("printf__", CFUNC(4), (Val)ts_printf__);
+
+  err |= TinyScript_Define("map_new", CFUNC(1), (Val)ts_map_new);
+  err |= TinyScript_Define("map_free", CPROC(1), (Val)ts_map_free);
+  err |= TinyScript_Define("map_get", CFUNC(2), (Val)ts_map_get);
+  err |= TinyScript_Define("map_has", CFUNC(2), (Val)ts_map_has);
+  err |= TinyScript_Define("map_set", CFUNC(3), (Val)ts_map_set);
+  err |= TinyScript_Define("map_del", CFUNC(2), (Val)ts_map_del);
+  err |= TinyScript_Define("map_size", CFUNC(1), (Val)ts_map_size);
+  err |= TinyScript_Define("map_iter", CFUNC(2), (Val)ts_map_iter);
+  err |= TinyScript_Define("map_key", CFUNC(2), (Val)ts_map_key);
+  err |= TinyScript_Define("map_value", CFUNC(2), (Val)ts_map_value);
+
+#ifdef ARRAY_SUPPORT
+  err |= TinyScript_Define("array_sum", CFUNC(1), (Val)ts_array_sum);
+  err |= TinyScript_Define("array_min", CFUNC(1), (Val)ts_array_min);
+  err |= TinyScript_Define("array_max", CFUNC(1), (Val)ts_array_max);
+  err |= TinyScript_Define("array_fill", CFUNC(2), (Val)ts_array_fill);
+  err |= TinyScript_Define("array_copy", CFUNC(4), (Val)ts_array_copy);
+  err |= TinyScript_Define("array_dot", CFUNC(2), (Val)ts_array_dot);
+  err |= TinyScript_Define("array_count", CFUNC(2), (Val)ts_array_count);
+  err |= TinyScript_Define("array_find", CFUNC(2), (Val)ts_array_find);
+  err |= TinyScript_Define("array_sort", CFUNC(1), (Val)ts_array_sort);
+  err |= TinyScript_Define("array_lower_bound", CFUNC(2), (Val)ts_array_lower_bound);
+  err |= TinyScript_Define("array_upper_bound", CFUNC(2), (Val)ts_array_upper_bound);
+#endif
 
-  err |= TinyScript_Define("free", CFUNC(1), (Val)ts_free);
+  err |= TinyScript_Define("free", CPROC(1), (Val)ts_object_free);
   return err;
 }
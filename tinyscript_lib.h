@@ -4,6 +4,37 @@
 #include <stdbool.h>
 #include "tinyscript.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Configuration */
+
+/* define TS_LIB_POOL to allocate list headers and small buffers from
+   pools of fixed size blocks, rather than with ts_malloc each time */
+#define TS_LIB_POOL
+
+/* number of pool size classes (up to 128 bytes), and the size of the
+   slabs which are requested from ts_malloc to hold the blocks */
+#define TS_POOL_CLASSES 6
+#define TS_POOL_SLAB_SIZE 2048
+
+/* define TS_LIB_REGION to allow lists made while a script runs to be
+   allocated from a region which is freed all at once afterwards */
+#define TS_LIB_REGION
+
+/* size of the chunks which regions request from ts_malloc */
+#define TS_REGION_CHUNK_SIZE 4096
+
+/* lists whose data fits in this many bytes keep it in the list header
+   (should be a multiple of sizeof(Val)) */
+#define TS_LIST_INLINE 16
+
+/* number of formats printf keeps parsed, and the size of its
+   output buffer */
+#define TS_FORMAT_CACHE 8
+#define TS_OUTPUT_BUFFER 128
+
 /* User needs to define these */
 void *ts_malloc(Val size);
 void ts_free(void *p);
@@ -11,14 +42,29 @@ void ts_free(void *p);
 /* Call this to initialize the standard library */
 int ts_define_funcs();
 
+/* Every library object starts with its kind, so that functions which
+   accept more than one kind of object (such as printf) can tell them
+   apart, and with whether it was allocated from a region */
+enum ts_kind { TS_KIND_LIST = 1, TS_KIND_MAP, TS_KIND_STR };
+
 /* List type */
+/* Elements are stored packed, width bytes each (1, 2, 4 or sizeof(Val)).
+   Lists grow automatically when pushed to beyond their capacity. */
 typedef struct ts_list {
+  uint8_t kind;
+  uint8_t region;
+  uint8_t width;
   Val size;
   uint8_t * data;
   Val capacity;
+  uint8_t small[TS_LIST_INLINE]; /* kept aligned for Val elements */
 } ts_list;
 
+/* ts_list_new makes a list of bytes; ts_list_new_width makes one with
+   8, 16 or 32 bit elements, or elements the size of a Val for any
+   other number of bits */
 ts_list * ts_list_new(Val capacity);
+ts_list * ts_list_new_width(Val capacity, Val bits);
 ts_list * ts_list_dup(ts_list * list);
 void ts_list_free(ts_list * list);
 
@@ -26,18 +72,169 @@ void ts_list_free(ts_list * list);
 Val ts_list_pop(ts_list * list);
 Val ts_list_get(ts_list * list, Val idx);
 
-/* Add element or elements to list end or set index. Return success status */
+/* Add element or elements to list end or set index. Return success status
+   (1 or 0, as a Val since scripts call them as builtins) */
 /* The push methods are otherwise identical, but the underscore ones are
 convenience methods to push more in a single line */
-bool ts_list_push(ts_list * list, Val val);
-bool ts_list_push_(ts_list * list, Val val1, Val val2);
-bool ts_list_push__(ts_list * list, Val val1, Val val2, Val val3);
-bool ts_list_set(ts_list * list, Val idx, Val val);
+Val ts_list_push(ts_list * list, Val val);
+Val ts_list_push_(ts_list * list, Val val1, Val val2);
+Val ts_list_push__(ts_list * list, Val val1, Val val2, Val val3);
+Val ts_list_set(ts_list * list, Val idx, Val val);
 Val ts_list_size(ts_list * list);
+void ts_list_truncate(ts_list * list, Val new_size);
+
+/* Grow a list in place (returns the list itself) */
+ts_list * ts_list_expand(ts_list * list, Val new_capacity);
+/* Append list_b to list_a in place */
+Val ts_list_append(ts_list * list_a, ts_list * list_b);
+/* Return a new list holding list_a followed by list_b */
+ts_list * ts_list_cat(ts_list * list_a, ts_list * list_b);
+
+/* Map type */
+/* Maps from Val keys to Val values; entries are found by index with
+   ts_map_iter, which returns the index of the first entry at or after
+   idx, or -1 when there are no more. Deleting entries while iterating
+   may cause other entries to be skipped or seen twice. */
+typedef struct ts_map_entry {
+  Val key;
+  Val value;
+} ts_map_entry;
+
+typedef struct ts_map {
+  uint8_t kind;
+  uint8_t region;
+  Val size;
+  Val capacity; /* number of slots, a power of 2 */
+  ts_map_entry * entries;
+  uint8_t * used;
+} ts_map;
+
+ts_map * ts_map_new(Val capacity);
+void ts_map_free(ts_map * map);
+/* Returns -1 if the key is not in the map */
+Val ts_map_get(ts_map * map, Val key);
+/* These return 1 or 0; they are Vals rather than bools because scripts
+   call them as builtins, which return a Val */
+Val ts_map_has(ts_map * map, Val key);
+Val ts_map_set(ts_map * map, Val key, Val value);
+Val ts_map_del(ts_map * map, Val key);
+Val ts_map_size(ts_map * map);
+Val ts_map_iter(ts_map * map, Val idx);
+Val ts_map_key(ts_map * map, Val idx);
+Val ts_map_value(ts_map * map, Val idx);
+
+/* String type */
+/* Strings are immutable; bytes holds len bytes followed by a NUL, so
+   it may be used directly as a C string. String literals in scripts
+   are interned, so equal literals are the same string. */
+typedef struct ts_str {
+  uint8_t kind;
+  uint8_t region;
+  uint8_t interned;
+  uint32_t hash;
+  Val len;
+  char bytes[];
+} ts_str;
+
+ts_str * ts_str_new(const char * bytes, Val len);
+/* Returns the one interned string with these bytes */
+ts_str * ts_str_intern(const char * bytes, Val len);
+ts_str * ts_str_to_interned(ts_str * str);
+/* Does nothing for interned strings */
+void ts_str_free(ts_str * str);
+Val ts_str_len(ts_str * str);
+/* Returns 1 or 0, as a Val since scripts call it as a builtin */
+Val ts_str_eq(ts_str * a, ts_str * b);
+/* Returns -1 if idx is out of range */
+Val ts_str_get(ts_str * str, Val idx);
+ts_str * ts_str_cat(ts_str * a, ts_str * b);
+ts_list * ts_str_to_list(ts_str * str);
+ts_str * ts_str_from_list(ts_list * list);
+
+#ifdef ARRAY_SUPPORT
+/* Array functions; arrays have their length in element 0 */
+Val ts_array_sum(Val * ary);
+Val ts_array_min(Val * ary);
+Val ts_array_max(Val * ary);
+Val ts_array_fill(Val * ary, Val val);
+Val ts_array_copy(Val * dst, Val * src, Val start, Val n);
+Val ts_array_dot(Val * a, Val * b);
+Val ts_array_count(Val * ary, Val val);
+Val ts_array_find(Val * ary, Val val);
+Val ts_array_sort(Val * ary);
+Val ts_array_lower_bound(Val * ary, Val val);
+Val ts_array_upper_bound(Val * ary, Val val);
+#endif
+
+#ifdef TS_LIB_POOL
+/* Pool statistics; fills in up to max entries, one per size class,
+   and returns the number filled in */
+typedef struct ts_pool_stats {
+  Val block_size;
+  Val slabs;
+  Val in_use;
+  Val free;
+} ts_pool_stats;
+
+int ts_pool_get_stats(ts_pool_stats * stats, int max);
+#endif
+
+#ifdef TS_LIB_REGION
+/* Regions; while a region is open new lists, maps and strings are
+   allocated from it. ts_region_end frees everything allocated in the
+   region, so objects which must outlive it have to be copied out with
+   ts_list_promote, ts_map_promote or ts_str_promote (which return
+   objects not in a region unchanged, and NULL if out of memory). Regions do not
+   nest; ts_region_begin returns false if one is already open.
+   ts_region_used returns the number of bytes the region holds. */
+bool ts_region_begin(void);
+void ts_region_end(void);
+Val ts_region_used(void);
+ts_list * ts_list_promote(ts_list * list);
+ts_map * ts_map_promote(ts_map * map);
+ts_str * ts_str_promote(ts_str * str);
+
+/* Several regions may be kept, one for each script context say, in the
+   way contexts are: ts_region_save saves the current region (or that
+   none is open) in a ts_region_state, and ts_region_switch makes a
+   saved one current again. Switching frees nothing, so a region which
+   is switched away from must be switched back to and ended later. */
+typedef struct ts_region_state {
+  struct ts_region_chunk * chunks;
+  bool active;
+} ts_region_state;
+
+void ts_region_save(ts_region_state * state);
+void ts_region_switch(const ts_region_state * state);
+#endif
+
+/* Formatted output */
+/* The format may be a string or a list of bytes. Conversions are
+   those of C printf for integers (d i u x X o c) plus s, which prints
+   a string or list of bytes (and anything else as a number, as d
+   does); every argument is a Val. Missing arguments are taken to be 0.
+   Returns the number of bytes written, or 0 if the format is not a
+   string or list. */
+Val ts_format(void * format, const Val * args, int nargs);
+Val ts_printf_v(int argc, Val * argv);
+Val ts_printf(void * format, Val a);
+Val ts_printf_(void * format, Val a, Val b);
+Val ts_printf__(void * format, Val a, Val b, Val c);
+
+/* Output from printf is collected in a buffer and given to the
+   function set here (or to outchar, one character at a time, if there
+   is none) at the end of each call */
+typedef void (*ts_output_fn)(const char * buf, Val len);
+void ts_set_output(ts_output_fn fn);
+void ts_flush_output(void);
 
 /* Utility functions */
 char * ts_list_to_string(const ts_list * list);
 ts_list * ts_string_to_list(const char * str);
 ts_list * ts_bytes_to_list(const char * str, int num_bytes);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* TINYSCRIPT_LIB_H */